@@ -1,55 +1,111 @@
 const { spawn } = require('child_process');
-const fs = require('fs');
 const path = require('path');
 
-const testsDir = path.resolve(__dirname, '../../compiler/tests');
-const inputPath = path.join(testsDir, 'input.txt');
-const inputQueuePath = path.join(testsDir, 'input_queue.txt');
 const compilerPath = path.resolve(__dirname, '../../compiler/build/Debug/pseudocode_compiler.exe');
+// Compiled programs keyed on their source, so re-running unchanged code skips compilation
+const cacheDir = path.resolve(__dirname, '../../compiler/cache');
+// Per-run budgets: a runaway loop, PRINT flood or recursion ends with a
+// message instead of holding a worker until the user notices. Time only
+// counts while the program executes, not while it waits for input.
+const runLimits = ['--max-time=10000', '--max-output=1048576', '--max-memory=256'];
 
+// One resident compiler (--serve) handles every run. Requests and events are
+// JSON lines tagged with a session ID; each Run gets a fresh session, owned
+// by the editor connection that started it.
 let compilerProcess = null;
+let nextSession = 1;
+const handlers = new Map();
+const currentSessions = new Map();  // connection ID -> its latest session
 
-function startCompilerWithIO(code, onOutput, onPrompt) {
-  // Ensure the tests directory exists
-  if (!fs.existsSync(testsDir)) {
-    fs.mkdirSync(testsDir, { recursive: true });
-    console.log('Created tests directory:', testsDir);
-  }
+const exitMessages = {
+  finished: '\n[Process exited with code 0]',
+  cancelled: '\n[Run cancelled]',
+  failed: '\n[Compilation failed]',
+};
+
+function send(request) {
+  compilerProcess.stdin.write(JSON.stringify(request) + '\n');
+}
 
-  // Write input.txt
-  fs.writeFileSync(inputPath, code);
-  fs.writeFileSync(inputQueuePath, '');
+function ensureCompiler() {
+  if (compilerProcess) return;
 
-  compilerProcess = spawn(compilerPath, { cwd: path.dirname(compilerPath) });
+  compilerProcess = spawn(compilerPath, ['--serve', `--cache-dir=${cacheDir}`, ...runLimits], {
+    cwd: path.dirname(compilerPath),
+  });
 
+  // Events are written in large batches, so a chunk can end mid-line
+  let pending = '';
   compilerProcess.stdout.on('data', (data) => {
-    const lines = data.toString().split('\n');
+    const lines = (pending + data.toString()).split('\n');
+    pending = lines.pop();
     for (const line of lines) {
       if (!line.trim()) continue;
+      let json;
       try {
-        const json = JSON.parse(line);
-        if (json.type === 'output') onOutput(json.message);
-        else if (json.type === 'input') onPrompt(json.prompt);
+        json = JSON.parse(line);
       } catch (err) {
-        onOutput(line);
+        continue;
+      }
+      const session = handlers.get(json.session);
+      if (!session) continue;
+      if (json.type === 'output') session.onOutput(json.message);
+      else if (json.type === 'input') session.onPrompt(json.prompt);
+      else if (json.type === 'error') session.onOutput(json.message);
+      else if (json.type === 'exit') {
+        if (json.status === 'limit-exceeded') session.onOutput(`\n[Run stopped: ${json.limit} limit exceeded]`);
+        else session.onOutput(exitMessages[json.status] || `\n[Run ${json.status}]`);
+        handlers.delete(json.session);
+        if (currentSessions.get(session.connection) === json.session) currentSessions.delete(session.connection);
+        send({ op: 'close', session: json.session });
       }
     }
   });
 
+  // Runtime errors arrive as session events; stderr is the compiler's own
   compilerProcess.stderr.on('data', (data) => {
-    onOutput('[stderr] ' + data.toString());
+    console.error('[compiler] ' + data.toString());
   });
 
   compilerProcess.on('close', (code) => {
-    onOutput(`\n[Process exited with code ${code}]`);
+    for (const session of handlers.values()) {
+      session.onOutput(`\n[Process exited with code ${code}]`);
+    }
+    handlers.clear();
+    currentSessions.clear();
+    compilerProcess = null;
   });
 }
 
-function sendInputToCompiler(val) {
-  fs.writeFileSync(inputQueuePath, val + '\n');
+function startCompilerWithIO(connection, code, onOutput, onPrompt) {
+  ensureCompiler();
+
+  // A new Run replaces the connection's previous one
+  stopCompilerRun(connection);
+
+  const session = String(nextSession++);
+  currentSessions.set(connection, session);
+  handlers.set(session, { connection, onOutput, onPrompt });
+  send({ op: 'run', session, code });
+}
+
+function sendInputToCompiler(connection, val) {
+  const session = currentSessions.get(connection);
+  if (compilerProcess && session && handlers.has(session)) {
+    send({ op: 'input', session, value: String(val) });
+  }
+}
+
+// The connection's run, if any, ends with its usual exit event
+function stopCompilerRun(connection) {
+  const session = currentSessions.get(connection);
+  if (compilerProcess && session && handlers.has(session)) {
+    send({ op: 'cancel', session });
+  }
 }
 
 module.exports = {
   startCompilerWithIO,
   sendInputToCompiler,
+  stopCompilerRun,
 };
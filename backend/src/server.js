@@ -1,20 +1,24 @@
 const { WebSocketServer } = require('ws');
-const { startCompilerWithIO, sendInputToCompiler } = require('./localRunner');
+const { startCompilerWithIO, sendInputToCompiler, stopCompilerRun } = require('./localRunner');
 
 const wss = new WebSocketServer({ port: 8080 });
+let nextConnection = 1;
 
 wss.on('connection', (ws) => {
+  // Runs, input and cancels stay with the connection that started them
+  const connection = nextConnection++;
   console.log("✅ Client connected");
 
   ws.on('message', async (message) => {
     try {
       const parsed = JSON.parse(message);
       if (parsed.type === 'input') {
-        sendInputToCompiler(parsed.value);
+        sendInputToCompiler(connection, parsed.value);
       }
     } catch {
       // Not JSON => treat as code
       startCompilerWithIO(
+        connection,
         message.toString(),
         (msg) => ws.send(JSON.stringify({ type: 'output', message: msg })),
         (prompt) => ws.send(JSON.stringify({ type: 'input', prompt }))
@@ -28,6 +32,7 @@ wss.on('connection', (ws) => {
 
   ws.on('close', () => {
     console.log("🔌 Client disconnected");
+    stopCompilerRun(connection);
   });
 
   ws.send('Connected to Compiler Server');
@@ -0,0 +1,45 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "compile_cache.h"
+#include "compiler_server.h"
+
+// --batch=PATH: compiles and runs many programs in one process, one job per
+// program on a ThreadPool. PATH is either a directory, whose *.txt files
+// (searched recursively) are the programs, or a manifest listing one
+// program per line, optionally followed by its input file; relative paths
+// are taken from the manifest's directory and # starts a comment.
+//
+// Program dir/name.txt reads its READ values, one per line, from
+// dir/name.in when no input is listed (no file: a READ fails). Its output
+// events go to dir/name.out and its diagnostics and runtime errors to
+// dir/name.err, which is only kept when not empty. A summary with the
+// status and timings of every program goes to stdout.
+class BatchRunner {
+public:
+    BatchRunner(const ServeOptions& options, unsigned workers);
+
+    // 0 when every program compiled and ran without errors
+    int run(const std::string& path);
+
+private:
+    struct Job {
+        std::string program;
+        std::string input;
+        std::string status;          // ok, compile-error, runtime-error, limit-exceeded, unreadable
+        double compileMs = 0;
+        double runMs = 0;
+    };
+
+    bool collect(const std::string& path, std::vector<Job>& jobs);
+    void runJob(Job& job);
+
+    ServeOptions options;
+    unsigned workers;
+    std::unique_ptr<CompileCache> cache;   // shared by every job
+};
+
+#endif // BATCH_RUNNER_H
@@ -0,0 +1,53 @@
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ir_program.h"
+
+// Compiled programs kept on disk as binary IR, named by a hash of the source
+// text and the compiler build, so pressing Run again on unchanged code maps
+// the program instead of compiling it. The directory is held under a size
+// bound by deleting the least recently used entries; a hit touches its file,
+// so modification time is the recency order. Each entry carries its source
+// text, and lookup() treats an entry whose source differs as a miss, so a
+// hash collision recompiles rather than runs another program. One cache may
+// be shared by sessions on several threads; each call holds the cache's lock.
+class CompileCache {
+public:
+    struct Stats {
+        unsigned long long hits = 0;
+        unsigned long long misses = 0;
+        unsigned long long evictions = 0;
+    };
+
+    CompileCache(const std::string& directory, uintmax_t maxBytes);
+
+    std::shared_ptr<IRProgram> lookup(const std::string& source);
+    // `program` must carry `source` (IRProgram::setSource) to be found again
+    void store(const std::string& source, const IRProgram& program);
+    Stats stats() const;
+
+private:
+    std::string pathFor(const std::string& source) const;
+    void evict();
+    struct Entry {
+        std::filesystem::path path;
+        uintmax_t size;
+        std::filesystem::file_time_type used;
+    };
+    std::vector<Entry> listEntries(uintmax_t& total) const;
+
+    std::string directory;
+    uintmax_t maxBytes;
+    uintmax_t totalBytes = 0;  // size of the entries, kept up to date by store()
+    bool usable = true;
+    Stats counters;
+    mutable std::mutex cacheMutex;
+};
+
+#endif // COMPILE_CACHE_H
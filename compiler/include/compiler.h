@@ -0,0 +1,26 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include "ir_program.h"
+
+// Where the intermediate stages are written when --dump is given; an empty
+// path skips that stage.
+struct CompileDumps {
+    std::string tokens;
+    std::string ast;
+    std::string ir;
+    std::string optimizedIr;
+};
+
+// Runs the whole front end (lexer, parser, semantic analysis, IR generation
+// and optimisation) and decodes the result. Lexer, parser and semantic
+// diagnostics go to `diagnostics`; a fatal parse error is thrown as
+// ParseError. Nothing else is shared, so calls on different threads are
+// independent.
+std::shared_ptr<IRProgram> compileSource(const std::string& source, std::ostream& diagnostics,
+                                         const CompileDumps* dumps = nullptr);
+
+#endif // COMPILER_H
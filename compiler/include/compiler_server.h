@@ -0,0 +1,132 @@
+#ifndef COMPILER_SERVER_H
+#define COMPILER_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "compile_cache.h"
+#include "compiler_session.h"
+#include "input_channel.h"
+#include "ir_interpreter.h"
+#include "ir_program.h"
+#include "output_writer.h"
+#include "thread_pool.h"
+
+// Settings shared by the modes running many programs (--serve, --websocket,
+// --batch, --grade)
+struct ServeOptions {
+    IRInterpreter::DispatchMode dispatchMode = IRInterpreter::DispatchMode::Threaded;
+    bool quickening = true;
+    bool memoization = true;
+    std::string cacheDir;          // empty: no compile cache
+    uintmax_t cacheBytes = 64ull << 20;
+    unsigned long long sliceInstructions = 1ull << 20;  // --serve time slice, 0: none
+    IRInterpreter::Limits limits;  // for every run; --serve requests may change them
+};
+
+// The limits for a run request: options.limits, with any maxInstructions,
+// maxTimeMs, maxOutputBytes or maxMemoryBytes the request gives in their place
+IRInterpreter::Limits requestLimits(const ServeOptions& options,
+                                    const std::unordered_map<std::string, std::string>& request);
+
+// --serve: one resident process handling many editor sessions, with one
+// JSON object per line on stdin (requests) and stdout (events). Requests:
+//
+//   {"op":"compile","session":ID,"code":SOURCE}
+//   {"op":"run","session":ID}              runs the last compiled program;
+//   {"op":"run","session":ID,"code":SOURCE}  or compiles SOURCE first
+//   {"op":"input","session":ID,"value":V}  answers a READ
+//   {"op":"cancel","session":ID}           stops the session's run
+//   {"op":"stats","session":ID}            reports the session's CPU use
+//   {"op":"close","session":ID}            cancels and forgets the session
+//
+// A run request may add "priority":"batch" (grading and other unattended
+// work); runs are "interactive" otherwise and always scheduled first. It
+// may also set "maxInstructions", "maxTimeMs", "maxOutputBytes" and
+// "maxMemoryBytes" in place of the server's limits ("0": none).
+//
+// Every event carries the session ID: "compiled" (with "cache": hit, miss
+// or off), "error" (with "message"; runtime errors too), the interpreter's
+// "output" and "input" events, "stats" and "exit", the last event of every
+// accepted run request (with "status": finished, cancelled,
+// limit-exceeded along with "limit": instructions, time, output or memory,
+// or failed when it never started). The exit of a run that started, and "stats", also give its
+// "instructions", "slices" and "cpuMs"; "stats" adds "state" (idle,
+// running or waiting) and "sessionCpuMs", summed over all its runs.
+//
+// Compilation happens on the request thread. Runs are green threads on a
+// fixed pool of workers: a run gives its worker back when it suspends on a
+// READ with no value yet (the "input" request queues it again) and after
+// every options.sliceInstructions instructions, when it goes to the back
+// of the queue. One endless loop therefore delays other sessions by a
+// slice at most, and idle sessions cost memory, not threads. Neither
+// "cancel" nor "close" waits for the run to stop: the request thread flags
+// it and goes on, and the run's worker sends its exit; a closed session is
+// freed once its run has ended.
+class CompilerServer {
+public:
+    // 0 workers means one per hardware thread
+    explicit CompilerServer(const ServeOptions& options, unsigned workers = 0);
+    ~CompilerServer();
+
+    // Handles requests until `in` ends, then cancels and joins every run
+    int serve(std::istream& in);
+
+private:
+    struct Session {
+        std::shared_ptr<const IRProgram> program;  // never run; each run gets a copy
+        std::unique_ptr<QueueInputChannel> input;
+        std::unique_ptr<LineEvents> errorEvents;   // runtime errors, as "error" events
+        std::unique_ptr<std::ostream> errors;
+        std::unique_ptr<CompilerSession> runner;   // the current run
+        ThreadPool::Priority priority = ThreadPool::Priority::Interactive;
+        std::atomic<bool> cancel{false};
+        // CPU accounting, written by the worker after each slice
+        std::atomic<unsigned long long> instructions{0};
+        std::atomic<unsigned long long> slices{0};
+        std::atomic<unsigned long long> runCpuMicros{0};
+        std::atomic<unsigned long long> totalCpuMicros{0};
+        std::mutex stateMutex;
+        std::condition_variable stopped;
+        bool running = false;    // started and not yet ended
+        bool waiting = false;    // suspended in READ, not queued on the pool
+    };
+
+    void handle(const std::string& line);
+    bool compile(const std::string& id, Session& session, const std::string& code);
+    void startRun(const std::string& id, Session& session,
+                  const std::unordered_map<std::string, std::string>& request);
+    // Queues the session's suspended run; the caller holds its stateMutex
+    void resumeRun(const std::string& id, Session& session);
+    // On a worker: starts `program`, or continues the run when it is null
+    void runSlice(const std::string& id, Session& session,
+                  const std::shared_ptr<const IRProgram>& program);
+    void afterSlice(const std::string& id, Session& session, IRInterpreter::RunStatus status);
+    // Flags the run to stop and returns; its worker sends the exit
+    void cancelRun(const std::string& id, Session& session);
+    // Cancels the run and waits for it to end
+    void stopRun(const std::string& id, Session& session);
+    // Frees the closed sessions whose runs have ended
+    void reapClosed();
+    bool isRunning(Session& session);
+    std::vector<std::pair<std::string, std::string>> usage(const Session& session);
+    void reply(const std::string& id, const std::string& type,
+               const std::string& key, const std::string& value);
+    void reply(const std::string& id, const std::string& type,
+               const std::vector<std::pair<std::string, std::string>>& fields);
+
+    ServeOptions options;
+    std::unique_ptr<CompileCache> cache;
+    std::unordered_map<std::string, std::unique_ptr<Session>> sessions;
+    std::vector<std::pair<std::string, std::unique_ptr<Session>>> closed;   // closed with a run still ending
+    ThreadPool workers;   // declared last: no run outlives the sessions
+};
+
+#endif // COMPILER_SERVER_H
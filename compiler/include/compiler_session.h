@@ -0,0 +1,89 @@
+#ifndef COMPILER_SESSION_H
+#define COMPILER_SESSION_H
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "compile_cache.h"
+#include "compiler.h"
+#include "input_channel.h"
+#include "ir_interpreter.h"
+#include "ir_program.h"
+#include "output_writer.h"
+
+// Everything one program needs to be compiled and run, with its I/O passed
+// in: where output events go, where READ takes values from, where
+// diagnostics and runtime errors are written, and the flag that cancels the
+// run. Nothing is read from a fixed path or written to a global stream
+// unless the caller hands one over, so independent sessions may compile
+// and run on different threads at once. A CompileCache may be shared.
+class CompilerSession {
+public:
+    enum class CacheResult { Off, Hit, Miss };
+
+    void setDispatchMode(IRInterpreter::DispatchMode mode) { dispatchMode = mode; }
+    void setQuickening(bool enabled) { quickening = enabled; }
+    void setMemoization(bool enabled) { memoization = enabled; }
+    void setCache(CompileCache* shared) { cache = shared; }
+    // Lexer, parser and semantic messages; stderr by default
+    void setDiagnostics(std::ostream& stream) { diagnostics = &stream; }
+    void setErrorStream(std::ostream& stream) { errors = &stream; }
+    void setOutputSession(const std::string& id) { outputSession = id; }
+    void setOutputSink(OutputWriter::Sink sink) { outputSink = std::move(sink); }
+    void setInputChannel(InputChannel* channel) { input = channel; }
+    void setCancelFlag(const std::atomic<bool>* flag) { cancelFlag = flag; }
+    void setSuspendOnRead(bool enabled) { suspendOnRead = enabled; }
+    void setSliceBudget(unsigned long long instructions) { sliceBudget = instructions; }
+    void setLimits(const IRInterpreter::Limits& budget) { limits = budget; }
+
+    // Returns the decoded program, from the cache when one is set and holds
+    // it (dumps force a fresh compile); a hit writes the diagnostics stored
+    // with it. On a parse error returns null and
+    // compileError() has the message.
+    std::shared_ptr<const IRProgram> compile(const std::string& source,
+                                             const CompileDumps* dumps = nullptr);
+    CacheResult cacheResult() const { return cached; }
+    const std::string& compileError() const { return error; }
+
+    // Runs a private copy of `program`, which stays untouched for reuse.
+    // With suspension on, WaitingForInput means the run is parked in a
+    // READ; resume() continues it, on any thread, once input has arrived.
+    // With a slice budget, Preempted means the same for a run that used up
+    // its slice; resume() gives it another.
+    IRInterpreter::RunStatus run(const std::shared_ptr<const IRProgram>& program);
+    IRInterpreter::RunStatus resume();
+    IRInterpreter::MemoStats memoStats() const { return memo; }
+    unsigned long long instructionCount() const { return instructions; }
+    // After LimitExceeded: the limit the run went over
+    IRInterpreter::Limit exceededLimit() const { return exceeded; }
+    // The run wrote a runtime [ERROR] to the error stream
+    bool errorReported() const { return reportedError; }
+
+private:
+    IRInterpreter::DispatchMode dispatchMode = IRInterpreter::DispatchMode::Threaded;
+    bool quickening = true;
+    bool memoization = true;
+    CompileCache* cache = nullptr;
+    std::ostream* diagnostics = &std::cerr;   // stdout carries the JSON events
+    std::ostream* errors = &std::cerr;
+    std::string outputSession;
+    OutputWriter::Sink outputSink;
+    InputChannel* input = nullptr;
+    const std::atomic<bool>* cancelFlag = nullptr;
+    bool suspendOnRead = false;
+    unsigned long long sliceBudget = 0;
+    IRInterpreter::Limits limits;
+
+    std::unique_ptr<IRInterpreter> interpreter;   // only while a run is suspended or preempted
+    CacheResult cached = CacheResult::Off;
+    std::string error;
+    IRInterpreter::MemoStats memo;
+    unsigned long long instructions = 0;
+    IRInterpreter::Limit exceeded = IRInterpreter::Limit::None;
+    bool reportedError = false;
+
+    IRInterpreter::RunStatus finish(IRInterpreter::RunStatus status);
+};
+
+#endif // COMPILER_SESSION_H
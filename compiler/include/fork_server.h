@@ -0,0 +1,52 @@
+#ifndef FORK_SERVER_H
+#define FORK_SERVER_H
+
+#include <string>
+#include <unordered_set>
+#include "compiler_server.h"
+
+// --fork-server=PATH: runs every program in a process of its own, for
+// deployments that want one run's crash or memory use kept away from the
+// others. The parent compiles and runs a small program once, so the lexer
+// keyword table, the decoder's operator table, the quickening tables
+// and the heap are set up, then pre-forks a pool of workers from that warm
+// image. Each worker accepts one connection on the Unix socket at PATH,
+// serves its job and exits; the parent forks a replacement right away, so
+// a client never waits for a fork, let alone an exec and a cold start.
+//
+// A job speaks the --serve protocol without session IDs. The client sends
+//
+//   {"op":"run","code":SOURCE}   first, optionally with the limits
+//                                (maxInstructions, maxTimeMs, maxOutputBytes,
+//                                maxMemoryBytes)
+//   {"op":"input","value":V}     for each READ
+//   {"op":"cancel"}              to stop the run
+//
+// and receives "compiled", "error", "output", "input" and a final "exit"
+// event, after which the worker closes the connection. Closing the
+// connection early ends the input, so a waiting READ fails.
+//
+// The parent runs until SIGINT or SIGTERM, then stops its workers and
+// removes the socket. Only built on Linux; elsewhere serve() reports that
+// and fails.
+class ForkServer {
+public:
+    // 0 workers means one per hardware thread
+    ForkServer(const ServeOptions& options, const std::string& socketPath, unsigned workers);
+
+    int serve();
+
+private:
+    void warmUp();
+    bool spawnWorker();
+    void serveJob();
+    void runJob(int fd);
+
+    ServeOptions options;
+    std::string socketPath;
+    unsigned workers;
+    int listenFd = -1;
+    std::unordered_set<int> children;   // pids of idle or busy workers
+};
+
+#endif // FORK_SERVER_H
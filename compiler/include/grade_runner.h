@@ -0,0 +1,54 @@
+#ifndef GRADE_RUNNER_H
+#define GRADE_RUNNER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "compiler_server.h"
+#include "ir_program.h"
+
+// --grade=DIR: runs one compiled program against every test case in DIR, in
+// parallel on a ThreadPool. A case is a pair name.in (READ values, one per
+// line) and name.expected (the PRINT output, one message per line). All
+// cases share the same decoded program; each run quickens its own copy.
+//
+// Prints a verdict per case (pass, wrong-answer with the first differing
+// line, runtime-error, limit-exceeded, missing-expected) with its
+// instruction count and wall time, then the number of cases passed. The
+// limits in ServeOptions apply to every case.
+//
+// With setLockstep(true) the cases are split into one group per worker and
+// each group runs as the lanes of a LockstepInterpreter, unless the program
+// calls functions.
+class GradeRunner {
+public:
+    GradeRunner(const ServeOptions& options, unsigned workers);
+
+    void setLockstep(bool enabled) { lockstep = enabled; }
+
+    // 0 when every case passed
+    int run(const std::shared_ptr<const IRProgram>& program, const std::string& casesDir);
+
+private:
+    struct Case {
+        std::string name;
+        std::string inputPath;
+        std::string expectedPath;
+        std::string verdict;
+        std::string detail;
+        unsigned long long instructions = 0;
+        double runMs = 0;
+    };
+
+    void runCase(Case& testCase);
+    void runLockstep(std::vector<Case*>& group);
+    void judge(Case& testCase, std::vector<std::string>& printed, const std::string& errors,
+               IRInterpreter::Limit exceeded);
+
+    ServeOptions options;
+    unsigned workers;
+    bool lockstep = false;
+    std::shared_ptr<const IRProgram> program;   // never run itself
+};
+
+#endif // GRADE_RUNNER_H
@@ -0,0 +1,64 @@
+#ifndef INPUT_CHANNEL_H
+#define INPUT_CHANNEL_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Source of the values consumed by READ. readLine blocks until a line is
+// available and returns false once the channel can never produce one.
+class InputChannel {
+public:
+    enum class Poll { Ready, Empty, Closed };
+
+    virtual ~InputChannel() = default;
+    virtual bool readLine(std::string& line) = 0;
+    // Non-blocking form for runs that suspend on READ. Channels that cannot
+    // tell whether a line is ready just block.
+    virtual Poll tryReadLine(std::string& line) { return readLine(line) ? Poll::Ready : Poll::Closed; }
+};
+
+// One value per line on the process's standard input (the editor backend
+// writes to the child's stdin pipe).
+class StdinInputChannel : public InputChannel {
+public:
+    bool readLine(std::string& line) override;
+};
+
+// Legacy queue file: the backend overwrites the file with a value and the
+// interpreter truncates it after reading the first line. On Linux the file
+// is watched with inotify; elsewhere it is polled.
+class FileInputChannel : public InputChannel {
+public:
+    explicit FileInputChannel(const std::string& path);
+    ~FileInputChannel() override;
+    bool readLine(std::string& line) override;
+
+private:
+    bool takeLine(std::string& line);
+    void waitForChange();
+
+    std::string path;
+    int inotifyFd = -1;
+};
+
+// Values handed over by another thread (a --serve session's "input"
+// requests). close() wakes a blocked reader and ends the channel.
+class QueueInputChannel : public InputChannel {
+public:
+    bool readLine(std::string& line) override;
+    Poll tryReadLine(std::string& line) override;
+    // A read would not block: a line is queued or the channel is closed
+    bool hasInput();
+    void push(const std::string& line);
+    void close();
+
+private:
+    std::mutex queueMutex;
+    std::condition_variable ready;
+    std::deque<std::string> lines;
+    bool closed = false;
+};
+
+#endif // INPUT_CHANNEL_H
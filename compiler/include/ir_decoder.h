@@ -0,0 +1,50 @@
+#ifndef IR_DECODER_H
+#define IR_DECODER_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ir_module.h"
+#include "ir_program.h"
+
+// Turns the generator's IR into an IRProgram: labels, functions and variables are
+// resolved to indices, instruction pairs are fused and pure functions are
+// marked. The result is what the interpreter runs and what --emit-ir saves.
+class IRDecoder {
+public:
+    std::shared_ptr<IRProgram> decode(const IRModule& module);
+
+private:
+    struct FunctionState {
+        std::string name;
+        int entry = 0;
+        int exit = 0;
+        int arity = 0;
+        bool pure = false;
+        std::vector<std::string> slotNames;
+        std::unordered_map<std::string, int> slotIndex;
+    };
+
+    void preprocess(const std::vector<IRLine>& lines);
+    void decodeLines(const std::vector<IRLine>& lines);
+    Instruction decodeLine(const IRLine& line);
+    Operand decodeOperand(const std::string& token);
+    int internSlot(const std::string& name);
+    int internString(const std::string& text);
+    void fuse();
+    void analyzePurity();
+
+    std::vector<Instruction> program;
+    std::vector<Operand> callArgs;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, int> stringIndex;
+    std::vector<FunctionState> functions;
+    int decodingFunction = 0;
+
+    std::vector<int> lineToInstruction;
+    std::unordered_map<std::string, int> labelMap;
+    std::unordered_map<std::string, int> functionMap;
+};
+
+#endif // IR_DECODER_H
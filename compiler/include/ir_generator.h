@@ -2,25 +2,27 @@
 #define IR_GENERATOR_H
 
 #include "ast.h"
-#include <fstream>
+#include "ir_module.h"
 #include <string>
 #include <vector>
 
 class IRGenerator {
 public:
-    IRGenerator(const std::string& outputPath);
-    void generate(ASTNode* root);  // Method to generate TAC from AST
+    IRModule generate(ASTNode* root);  // Method to generate TAC from AST
 
 private:
-    std::ofstream outFile;         // Output file for storing the generated TAC
+    IRModule module;               // TAC produced so far
     int tempVarCount = 0;          // Counter for temporary variable generation
 
+    void emit(IRLine line) { module.lines.push_back(std::move(line)); }
+
     std::string generateExpression(ASTNode* node); // Generates TAC for an expression
     void generateStatement(ASTNode* node);         // Generates TAC for a statement
     void handleIfElseIf(ASTNode* node);            // Handles if-else-if statements
     void generateIfStatement(ASTNode* node);      // Generates TAC for if statements
     void generateLoopStatement(ASTNode* node);    // Generates TAC for loop statements
     void generateFunctionCall(ASTNode* node);     // Generates TAC for function calls
+    std::string generateCall(ASTNode* node);      // Emits a CALL into a new temporary and returns it
     std::string newTemp();                        // Generates a new temporary variable for TAC
 };
 
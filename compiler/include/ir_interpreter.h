@@ -4,35 +4,190 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
-#include <stack>
+#include <memory>
+#include <atomic>
+#include <iostream>
+#include <chrono>
+#include <memory_resource>
+#include "ir_module.h"
+#include "ir_program.h"
+#include "output_writer.h"
+#include "input_channel.h"
+#include "run_arena.h"
 
 class IRInterpreter {
 public:
-    void interpret(const std::string& path);
+    // Both engines run the same handlers (src/ir_dispatch.inc); Threaded is
+    // only compiled in when the compiler supports labels-as-values.
+    enum class DispatchMode { Switch, Threaded };
+
+    enum class RunStatus { Finished, Cancelled, WaitingForInput, Preempted, LimitExceeded };
+
+    // Decodes the module and runs it
+    RunStatus interpret(const IRModule& module);
+    // Runs an already decoded (or loaded) program, which is never written:
+    // with quickening on, the code is copied for the run to rewrite; with it
+    // off, the run reads the program's own tables (or mapped file).
+    RunStatus run(std::shared_ptr<const IRProgram> program);
+
+    // With suspension on, a READ whose channel has no value ready does not
+    // block: run() or resume() returns WaitingForInput with the whole run
+    // state kept here, and resume() continues at that READ once the channel
+    // has input (or has closed, or the run was cancelled). The thread that
+    // calls resume() need not be the one that started the run.
+    void setSuspendOnRead(bool enabled) { suspendOnRead = enabled; }
+    RunStatus resume();
+    // Ends run() or resume() with Preempted once it has dispatched about
+    // `instructions` instructions, keeping the state for resume() as a
+    // suspension does. Checked with the cancel flag, so a slice overruns by
+    // at most kCheckInterval taken jumps or calls. 0 (the default) never
+    // preempts.
+    void setSliceBudget(unsigned long long instructions) { sliceBudget = instructions ? instructions : ~0ull; }
+
+    // Budgets for the whole run, 0 meaning none. A run over one ends with
+    // LimitExceeded and exceededLimit() says which; nothing is printed.
+    // Output is checked before every PRINT, and the line that would go over
+    // is not written; instructions and time with the cancel flag, so a run
+    // may overshoot those by up to kCheckInterval taken jumps or calls. Time
+    // counts only while the run executes, not while it is suspended or
+    // preempted.
+    struct Limits {
+        unsigned long long instructions = 0;
+        unsigned long long milliseconds = 0;
+        unsigned long long outputBytes = 0;
+        // The run's arena (see RunArena): a quarter of it goes to the call
+        // stack and a quarter to the slot stack, when less than their
+        // usual size; a deeper recursion then counts as over the limit
+        unsigned long long memoryBytes = 0;
+    };
+    enum class Limit { None, Instructions, Time, OutputBytes, Memory };
+    void setLimits(const Limits& budget);
+    Limit exceededLimit() const { return exceeded; }
+    // "instructions", "time", "output" or "memory", as reported to the editor
+    static const char* limitName(Limit limit);
+    void setDispatchMode(DispatchMode mode) { dispatchMode = mode; }
+    void setQuickening(bool enabled) { quickening = enabled; }
+    void setInputChannel(InputChannel* channel) { input = channel; }
+    void setOutputSession(const std::string& id) { output.setSession(id); }
+    void setOutputSink(OutputWriter::Sink sink) { output.setSink(std::move(sink)); }
+    // Runtime errors (missing label or function, stack overflow, no input),
+    // written after the output that came before them has been flushed
+    void setErrorStream(std::ostream& stream) { errors = &stream; }
+    // The last run wrote an [ERROR] (warnings do not count)
+    bool errorReported() const { return reportedError; }
+
+    // Another thread sets the flag to stop the run. It is polled every
+    // kCheckInterval taken jumps (every loop iteration or IF costs one), and
+    // a READ woken by its channel closing also gives up.
+    void setCancelFlag(const std::atomic<bool>* flag) { cancelFlag = flag; }
+
+    // Calls to functions proven pure (no PRINT, READ or array access, and
+    // only pure callees) are answered from a bounded per-run cache keyed on
+    // their arguments. Teaching runs that must show the naive cost turn it off.
+    struct MemoStats {
+        unsigned long long hits = 0;
+        unsigned long long misses = 0;
+        size_t entries = 0;
+    };
+    void setMemoization(bool enabled) { memoization = enabled; }
+    MemoStats memoStats() const;
+    // Instructions dispatched by the last run (a fused pair counts once)
+    unsigned long long instructionCount() const { return executed; }
+    static bool threadedDispatchAvailable();
 
 private:
+    // Frames live in one preallocated array and their slots in another,
+    // both in the run's arena; a frame's slots start right after its
+    // caller's. Trivial, so the preallocated array is not touched until
+    // frames are pushed; a call sets every field.
     struct Frame {
-        std::unordered_map<std::string, int> variables;
-        std::string returnTarget;
-        int returnAddress = -1;
+        int function;
+        int base;            // offset of the frame's slots in slotStack
+        int returnTarget;    // caller slot receiving the return value
+        int returnAddress;
+        int memoBase;        // memoised call: its key in memoKeyStack
     };
 
-    std::vector<std::string> readIR(const std::string& path);
-    void preprocess(const std::vector<std::string>& lines);
+    enum class ReadResult { Read, Failed, Suspended };
+
+    struct MemoKeyHash {
+        size_t operator()(const std::pmr::vector<int>& key) const;
+    };
+
+    // What a run allocates as it goes. Placed in the run's arena and never
+    // destroyed: dropping the arena frees it all at once.
+    struct RunMemory {
+        explicit RunMemory(std::pmr::memory_resource* resource)
+            : memo(resource), memoKey(resource), memoKeyStack(resource), argScratch(resource) {}
+        std::pmr::unordered_map<std::pmr::vector<int>, int, MemoKeyHash> memo;
+        std::pmr::vector<int> memoKey;        // reused for lookups
+        std::pmr::vector<int> memoKeyStack;   // keys of memoised calls still running
+        std::pmr::vector<int> argScratch;
+    };
+
+    static const int kMaxFrames = 1 << 20;
+    static const int kStackSlots = 1 << 22;
+    static const size_t kMemoCapacity = 1 << 18;
+    static const int kCheckInterval = 1 << 12;
+
+    void quicken(Instruction& instr);
+
+    void allocateRun();
+    void countRunEnd();
     void execute();
-    void executeLine(const std::string& line);
-    int evaluateOperand(const std::string& token);
-    void jumpToLabel(const std::string& label);
-    void callFunction(const std::string& name, const std::vector<std::string>& args, const std::string& target);
-
-    std::vector<std::string> irCode;
-    std::unordered_map<std::string, int> labelMap;
-    std::unordered_map<std::string, int> functionMap;
+    void executeSwitch();
+    void executeThreaded();
+    bool stopRequested();
+    bool overLimit(unsigned long long count);
+    std::ostream& reportError();
+    ReadResult readInput(int slot, int& value);
+    int evaluateOperand(const Operand& operand);
+    void callFunction(const Instruction& instr);
+    void tailCallFunction(const Instruction& instr);
+    void returnFromFunction(int value);
+
+    std::shared_ptr<const IRProgram> program;
+    const Instruction* runCode = nullptr;     // program->code, or quickenedCode
+    std::vector<Instruction> quickenedCode;   // the copy quickening rewrites
     std::unordered_map<std::string, std::vector<int>> arrays;
     std::unordered_map<std::string, std::unordered_map<std::string, int>> structs;
 
-    std::stack<Frame> callStack;
+    DispatchMode dispatchMode = DispatchMode::Threaded;
+    bool quickening = true;
+    bool memoization = true;
+    bool suspendOnRead = false;
+    bool awaitingInput = false;   // suspended in a READ whose prompt is out
+    std::vector<const void*> threadedCode;  // handler address per instruction
+
+    OutputWriter output;
+    InputChannel* input = nullptr;
+    std::ostream* errors = &std::cerr;
+    bool reportedError = false;
+    const std::atomic<bool>* cancelFlag = nullptr;
+    RunStatus status = RunStatus::Finished;
+    unsigned long long sliceBudget = ~0ull;
+    Limits limits;
+    bool limited = false;        // an instruction or time limit is set
+    unsigned long long outputCap = ~0ull;
+    Limit exceeded = Limit::None;
+    std::chrono::steady_clock::time_point sliceStart;
+    std::chrono::steady_clock::duration runTime{};   // spent executing, over all slices
+
+    std::unique_ptr<RunArena> arena;   // kept until the next run, for memoStats()
+    RunMemory* memory = nullptr;
+    Frame* callStack = nullptr;
+    int* slotStack = nullptr;
+    int maxFrames = 0;
+    int stackSlots = 0;
+    bool stacksCut = false;      // the memory limit made the stacks smaller
+    int callDepth = 0;           // index of the current frame in callStack
+    int* slots = nullptr;        // slots of the current frame
+
+    bool memoFull = false;       // the arena ran out while caching a result
+    MemoStats memoCounters;
     int instructionPointer = 0;
+    unsigned long long executed = 0;
+    unsigned long long dispatched = 0;   // by the current slice, as of its last VM_SAVE
 };
 
 #endif
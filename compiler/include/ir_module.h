@@ -0,0 +1,104 @@
+#ifndef IR_MODULE_H
+#define IR_MODULE_H
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One instruction, label or directive of the three-address code, already
+// split into its parts so no later stage parses text. Operands are kept as
+// the generator wrote them: a variable or temp name, an integer, TRUE or
+// FALSE, or (PRINT only) a quoted string.
+struct IRLine {
+    enum Kind {
+        Label, Function, EndFunction, Param,
+        Binary, Copy, Print, Read, IfNot, Goto, Return, Call, Access,
+        Raw   // anything else (structs, element reads); the whole line is in `a`
+    };
+
+    Kind kind = Raw;
+    std::string dst;                 // Binary, Copy, Read, Call
+    std::string a;                   // the operand; Binary's left one
+    std::string op;                  // Binary: + - * / % == != < <= > >=
+    std::string b;                   // Binary's right operand
+    std::string name;                // label, function, parameter, jump target, callee, array
+    std::vector<std::string> args;   // Call
+
+    static IRLine label(std::string name) { return make(Label, "", "", std::move(name)); }
+    static IRLine function(std::string name) { return make(Function, "", "", std::move(name)); }
+    static IRLine endFunction() { return make(EndFunction, "", "", ""); }
+    static IRLine param(std::string name) { return make(Param, "", "", std::move(name)); }
+    static IRLine binary(std::string dst, std::string a, std::string op, std::string b) {
+        IRLine line = make(Binary, std::move(dst), std::move(a), "");
+        line.op = std::move(op);
+        line.b = std::move(b);
+        return line;
+    }
+    static IRLine copy(std::string dst, std::string a) { return make(Copy, std::move(dst), std::move(a), ""); }
+    static IRLine print(std::string a) { return make(Print, "", std::move(a), ""); }
+    static IRLine read(std::string dst) { return make(Read, std::move(dst), "", ""); }
+    static IRLine ifNot(std::string a, std::string target) {
+        return make(IfNot, "", std::move(a), std::move(target));
+    }
+    static IRLine jump(std::string target) { return make(Goto, "", "", std::move(target)); }
+    static IRLine ret(std::string a) { return make(Return, "", std::move(a), ""); }
+    static IRLine call(std::string dst, std::string callee, std::vector<std::string> args) {
+        IRLine line = make(Call, std::move(dst), "", std::move(callee));
+        line.args = std::move(args);
+        return line;
+    }
+    static IRLine access(std::string array, std::string index) {
+        return make(Access, "", std::move(index), std::move(array));
+    }
+    static IRLine raw(std::string text) { return make(Raw, "", std::move(text), ""); }
+
+    // The text form, as --dump writes it
+    std::string toString() const {
+        switch (kind) {
+        case Label:       return name + ":";
+        case Function:    return "FUNCTION " + name + ":";
+        case EndFunction: return "END FUNCTION";
+        case Param:       return "PARAM " + name;
+        case Binary:      return dst + " = " + a + " " + op + " " + b;
+        case Copy:        return dst + " = " + a;
+        case Print:       return "PRINT " + a;
+        case Read:        return "READ " + dst;
+        case IfNot:       return "IF NOT " + a + " GOTO " + name;
+        case Goto:        return "GOTO " + name;
+        case Return:      return "RETURN " + a;
+        case Call: {
+            std::string text = dst + " = CALL " + name + "(";
+            for (size_t i = 0; i < args.size(); ++i) text += (i ? ", " : "") + args[i];
+            return text + ")";
+        }
+        case Access:      return "ACCESS " + name + "[" + a + "]";
+        case Raw:         break;
+        }
+        return a;
+    }
+
+private:
+    static IRLine make(Kind kind, std::string dst, std::string a, std::string name) {
+        IRLine line;
+        line.kind = kind;
+        line.dst = std::move(dst);
+        line.a = std::move(a);
+        line.name = std::move(name);
+        return line;
+    }
+};
+
+// Three-address code as handed from IRGenerator to IROptimizer to
+// IRDecoder, one IRLine per instruction, label or directive. The text form
+// on disk is only produced on request (--dump).
+struct IRModule {
+    std::vector<IRLine> lines;
+
+    void dump(const std::string& path) const {
+        std::ofstream out(path);
+        for (const auto& line : lines) out << line.toString() << '\n';
+    }
+};
+
+#endif // IR_MODULE_H
@@ -3,18 +3,17 @@
 
 #include <string>
 #include <vector>
+#include "ir_module.h"
 
 class IROptimizer {
 public:
-    void optimize(const std::string& inputPath, const std::string& outputPath);
+    IRModule optimize(const IRModule& input);
 
 private:
-    std::vector<std::string> readIR(const std::string& path);
-    void writeIR(const std::vector<std::string>& lines, const std::string& path);
-    std::vector<std::string> performOptimizations(const std::vector<std::string>& lines);
+    std::vector<IRLine> performOptimizations(const std::vector<IRLine>& lines);
 
-    std::string foldConstants(const std::string& line);
-    bool isConstantExpression(const std::string& expr);
+    IRLine foldConstants(const IRLine& line);
+    bool isConstantExpression(const IRLine& line);
     std::string evaluateConstantExpr(const std::string& left, const std::string& op, const std::string& right);
 };
 
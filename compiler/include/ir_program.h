@@ -0,0 +1,182 @@
+#ifndef IR_PROGRAM_H
+#define IR_PROGRAM_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Decoded form of the text IR. Every IR line is decoded once into an
+// Instruction; the interpreter only ever dispatches on these records.
+//
+// The opcode list is an X-macro so the threaded dispatch table in the
+// interpreter is generated in enum order and cannot drift from it.
+#define IR_OPCODES(X)                                                       \
+    X(Nop)                                                                  \
+    X(FunctionEntry)  /* FUNCTION f: (skips the body on fall-through) */    \
+    X(EndFunction)    /* END FUNCTION (implicit RETURN 0) */                \
+    X(Copy)           /* dst = a */                                         \
+    X(Add) X(Sub) X(Mul) X(Div) X(Mod)                                      \
+    X(Eq) X(Ne) X(Lt) X(Le) X(Gt) X(Ge)                                     \
+    X(Print)          /* PRINT var (text = operand spelling) */             \
+    X(PrintString)    /* PRINT "literal" (text = literal) */                \
+    X(Read)           /* READ dst */                                        \
+    X(IfNotGoto)      /* IF NOT a GOTO target */                            \
+    X(Goto)           /* GOTO target */                                     \
+    X(IfNotEq) X(IfNotNe) X(IfNotLt)  /* fused "t = a op b; IF NOT t GOTO" */ \
+    X(IfNotLe) X(IfNotGt) X(IfNotGe)                                        \
+    X(Call)           /* dst = CALL target(args...) */                      \
+    X(TailCall)       /* fused "t = CALL f(...); RETURN t" */               \
+    X(Return)         /* RETURN a */                                        \
+    X(Access)         /* ACCESS text[a] */                                  \
+    X(Unknown)        /* unrecognised line, reported when run (text) */     \
+    X(Halt)           /* sentinel appended after the last instruction */   \
+    IR_QUICK_OPCODES(X)
+
+// Specialised forms the interpreter rewrites generic instructions into after
+// their first execution (quickening). VV reads two slots, VI a slot and an
+// immediate; no instruction is ever decoded into one of these directly.
+#define IR_QUICK_OPCODES(X)                                                 \
+    X(CopyV) X(CopyI)                                                       \
+    X(AddVV) X(AddVI) X(SubVV) X(SubVI) X(MulVV) X(MulVI)                   \
+    X(DivVV) X(DivVI) X(ModVV) X(ModVI)                                     \
+    X(EqVV) X(EqVI) X(NeVV) X(NeVI) X(LtVV) X(LtVI)                         \
+    X(LeVV) X(LeVI) X(GtVV) X(GtVI) X(GeVV) X(GeVI)                         \
+    X(IfNotEqVV) X(IfNotEqVI) X(IfNotNeVV) X(IfNotNeVI)                     \
+    X(IfNotLtVV) X(IfNotLtVI) X(IfNotLeVV) X(IfNotLeVI)                     \
+    X(IfNotGtVV) X(IfNotGtVI) X(IfNotGeVV) X(IfNotGeVI)
+
+enum class OpCode : uint8_t {
+#define IR_OPCODE_ENUM(name) name,
+    IR_OPCODES(IR_OPCODE_ENUM)
+#undef IR_OPCODE_ENUM
+};
+
+struct Operand {
+    enum Kind : uint8_t { Immediate, Variable };
+
+    Kind kind = Immediate;
+    int value = 0;  // literal value, or frame slot for variables
+};
+
+// Division as programs see it: by zero gives 0, and INT_MIN / -1 wraps
+// around to INT_MIN (its remainder is 0) instead of trapping
+inline int32_t divideInt(int32_t a, int32_t b) {
+    if (b == 0) return 0;
+    if (b == -1) return static_cast<int32_t>(0u - static_cast<uint32_t>(a));
+    return a / b;
+}
+inline int32_t remainderInt(int32_t a, int32_t b) {
+    return b == 0 || b == -1 ? 0 : a % b;
+}
+
+struct Instruction {
+    OpCode op = OpCode::Nop;
+    uint8_t quickened = 0;  // set once the interpreter has specialised it
+    int dst = -1;       // frame slot written by the instruction
+    Operand a;
+    Operand b;
+    int target = -1;    // jump target / callee function / end of function body
+    int text = -1;      // index into the string pool
+    int argBegin = 0;   // CALL arguments live in a side table
+    int argCount = 0;
+};
+
+// Variables and temps are resolved to dense slots per function when the IR
+// is decoded; function 0 is the top-level program. Parameters take the
+// first `arity` slots, so binding arguments is a plain copy.
+struct FunctionRecord {
+    int32_t entry = 0;       // first instruction of the body
+    int32_t exit = 0;        // the END FUNCTION instruction
+    int32_t arity = 0;
+    int32_t frameSize = 0;
+    int32_t name = -1;       // index into the string pool
+    int32_t slotNames = 0;   // first of frameSize entries in the slot name table
+    int32_t pure = 0;
+};
+
+struct LabelRecord {
+    int32_t name = -1;       // index into the string pool
+    int32_t target = -1;     // instruction the label resolves to
+};
+
+// A decoded and fused program. The interpreter only reads it through the
+// pointers below, which point either into tables built by IRDecoder or
+// straight into a binary IR file mapped read-only by load(). Nothing writes
+// to a program once built, so one may be run any number of times, at once
+// on several threads; quickening rewrites a per-run copy of the code.
+class IRProgram {
+public:
+    const Instruction* code = nullptr;
+    size_t codeSize = 0;                  // including the trailing Halt
+    const Operand* callArgs = nullptr;
+    size_t callArgCount = 0;
+    const FunctionRecord* functions = nullptr;
+    size_t functionCount = 0;
+    const int32_t* slotNames = nullptr;   // string pool index per slot
+    size_t slotNameCount = 0;
+    const LabelRecord* labels = nullptr;
+    size_t labelCount = 0;
+    const uint32_t* stringOffsets = nullptr;  // stringCount + 1 entries
+    const char* stringData = nullptr;
+    size_t stringCount = 0;
+    // Front-end warnings from the compile, so a cached program shows them
+    // again without running the front end
+    std::string_view diagnostics;
+    // The source text the program was compiled from, so that a cache can
+    // tell its entry apart from another source whose key collides
+    std::string_view source;
+
+    // What IRDecoder produces; fromTables() takes ownership of it
+    struct Tables {
+        std::vector<Instruction> code;
+        std::vector<Operand> callArgs;
+        std::vector<FunctionRecord> functions;
+        std::vector<int32_t> slotNames;
+        std::vector<LabelRecord> labels;
+        std::vector<std::string> strings;
+    };
+
+    // Version of the binary container; bumped whenever the opcode list or a
+    // record changes shape
+    static const uint32_t kFormatVersion = 3;
+
+    IRProgram() = default;
+    IRProgram(const IRProgram&) = delete;
+    IRProgram& operator=(const IRProgram&) = delete;
+    ~IRProgram();
+
+    static std::shared_ptr<IRProgram> fromTables(Tables tables);
+    void setDiagnostics(std::string text);
+    void setSource(std::string text);
+
+    // Versioned binary container (layout in ir_program.cpp). load() maps the
+    // file and points the tables into it; nothing is parsed or copied, but
+    // every index is checked, so a damaged file is refused rather than run.
+    // Both return false / nullptr and describe the problem in `error`.
+    // Any number of processes may save to the same path at once.
+    bool save(const std::string& path, std::string& error) const;
+    static std::shared_ptr<IRProgram> load(const std::string& path, std::string& error);
+
+    std::string_view stringAt(int index) const {
+        return std::string_view(stringData + stringOffsets[index],
+                                stringOffsets[index + 1] - stringOffsets[index]);
+    }
+    std::string_view slotName(int function, int slot) const {
+        return stringAt(slotNames[functions[function].slotNames + slot]);
+    }
+
+private:
+    Tables owned;
+    std::vector<uint32_t> ownedOffsets;
+    std::string ownedData;
+    std::string ownedDiagnostics;
+    std::string ownedSource;
+
+    void* mapping = nullptr;              // load(): the mapped file
+    size_t mappingSize = 0;
+    std::vector<char> fileBuffer;         // load() where mmap is unavailable
+};
+
+#endif // IR_PROGRAM_H
@@ -0,0 +1,13 @@
+#ifndef JSON_LINE_H
+#define JSON_LINE_H
+
+#include <string>
+#include <unordered_map>
+
+// Reader for the requests of the line protocols: one flat JSON object per
+// line whose values are strings, numbers, booleans or null. Every value is
+// returned as text (strings unescaped, literals as written). Nested objects
+// and arrays are rejected; OutputWriter writes the replies.
+bool parseJsonLine(const std::string& line, std::unordered_map<std::string, std::string>& fields);
+
+#endif // JSON_LINE_H
@@ -1,6 +1,7 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <iostream>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -13,7 +14,9 @@ private:
     string input;
     size_t pos;
     char currentChar;
-    unordered_map<string, TokenType> keywords;
+    ostream& diagnostics;
+
+    static const unordered_map<string, TokenType>& keywords();
 
     void advance();
     void skipWhitespace();
@@ -25,7 +28,7 @@ private:
     
 
 public:
-    Lexer(const string& input);
+    Lexer(const string& input, ostream& diagnostics = cerr);
     vector<Token> tokenize();
 };
 
@@ -0,0 +1,84 @@
+#ifndef LOCKSTEP_INTERPRETER_H
+#define LOCKSTEP_INTERPRETER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+#include "input_channel.h"
+#include "ir_interpreter.h"
+#include "ir_program.h"
+#include "output_writer.h"
+
+// Runs one program for many inputs at once. Every slot holds one value per
+// lane, stored contiguously, so an instruction is decoded and dispatched
+// once and its arithmetic or comparison is applied to all lanes in one
+// loop the compiler vectorises (AVX2 when the CPU has it, on GCC/Linux).
+//
+// A mask says which lanes the current instruction applies to. When a branch
+// splits the lanes, the group with the lower target continues and the other
+// is parked at its target; a group whose next instruction is where lanes
+// are parked takes them back in. Always running the lowest pending target
+// makes lanes that leave a loop early wait at its exit for the rest.
+//
+// Programs that call functions are not supported (supports() says so);
+// run them lane by lane on IRInterpreter instead.
+class LockstepInterpreter {
+public:
+    struct Lane {
+        InputChannel* input = nullptr;
+        OutputWriter::Sink output;
+        std::ostream* errors = &std::cerr;
+        unsigned long long instructions = 0;   // set by run()
+        IRInterpreter::Limit exceeded = IRInterpreter::Limit::None;   // set by run()
+    };
+
+    static const int kMaxLanes = 256;
+
+    static bool supports(const IRProgram& program);
+
+    void setCancelFlag(const std::atomic<bool>* flag) { cancelFlag = flag; }
+    // Per lane, as IRInterpreter applies them to one run, except time: that
+    // is the group's, so every lane still running when it is up stops.
+    // A lane over a limit halts; the others go on.
+    void setLimits(const IRInterpreter::Limits& budget) { limits = budget; }
+
+    // Runs every lane to its end; the program is only read
+    IRInterpreter::RunStatus run(const IRProgram& program, std::vector<Lane>& lanes);
+
+private:
+    static const int kCheckInterval = 1 << 12;
+
+    int32_t* row(int slot) { return slotData.data() + static_cast<size_t>(slot) * width; }
+    const int32_t* source(const Operand& operand, int32_t* scratch);
+    void flushSteps();
+    void park(const int32_t* lanesMask, int target);
+    void unpark(int target);
+    void moveTo(int next);
+    bool haltLanes(const int32_t* lanesMask);
+    bool haltOverLimit();
+    void read(const Instruction& instr);
+
+    const IRProgram* program = nullptr;
+    std::vector<Lane>* lanes = nullptr;
+    const std::atomic<bool>* cancelFlag = nullptr;
+    IRInterpreter::Limits limits;
+    std::chrono::steady_clock::time_point started;
+    std::vector<std::unique_ptr<OutputWriter>> writers;
+
+    int width = 0;                    // lanes rounded up to a multiple of 8
+    std::vector<int32_t> slotData;    // slot s of lane l at s * width + l
+    std::vector<int32_t> mask;        // -1 for lanes in the running group
+    std::vector<int32_t> jump;        // per lane: takes the current branch
+    std::vector<int32_t> scratchA;
+    std::vector<int32_t> scratchB;
+    std::vector<int> parkedAt;        // target a lane waits at, or -1
+    std::map<int, int> parked;        // target -> lanes waiting there
+    int pc = 0;
+    unsigned long long steps = 0;     // instructions run by the group since its mask changed
+};
+
+#endif // LOCKSTEP_INTERPRETER_H
@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Monotonic count. add() is one relaxed atomic add, so any thread may count
+// without taking a lock.
+class Counter {
+public:
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t load() const { return value.load(std::memory_order_relaxed); }
+    void clear() { value.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+// Distribution of values (nanoseconds, for the latency histograms) in
+// log-linear buckets, the layout HdrHistogram uses: one bucket per value
+// below 64, then 32 buckets for every power of two, so any recorded value
+// is known to within 1/32 of itself. Values from 2^44 (about five hours in
+// nanoseconds) up share the last bucket. record() is two relaxed atomic
+// adds and never locks; a snapshot taken while others record may miss
+// their latest values but is otherwise consistent.
+class Histogram {
+public:
+    static const int kSubBits = 5;
+    static const int kMaxExponent = 44;
+    static const int kBuckets = (kMaxExponent - kSubBits + 1) << kSubBits;
+
+    void record(uint64_t value);
+    // Records the time from `start` to now and returns now, so consecutive
+    // phases can be timed from one clock reading each
+    std::chrono::steady_clock::time_point recordSince(std::chrono::steady_clock::time_point start);
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t buckets[kBuckets] = {};
+
+        // Middle of the bucket holding the q-th value; 0 when empty
+        double quantile(double q) const;
+    };
+    void snapshot(Snapshot& into) const;
+    void clear();
+
+private:
+    static int bucketOf(uint64_t value);
+
+    std::atomic<uint64_t> buckets[kBuckets] = {};
+    std::atomic<uint64_t> sum{0};
+};
+
+// Everything the compiler counts about itself, as a fixed set of counters
+// and histograms, so recording never looks anything up. global() is the
+// process's registry; it lives in shared memory where the platform has it,
+// so workers forked from the process (--fork-server) record into the
+// parent's copy as long as the parent called global() before forking.
+struct Metrics {
+    enum Phase { Lex, Parse, Semantic, Generate, Optimize, Decode, kPhases };
+    enum RunEnd { Finished, Cancelled, LimitExceeded, kRunEnds };
+
+    Counter compiles;            // compile requests, cache hits included
+    Counter compileErrors;
+    Counter cacheHits;
+    Counter cacheMisses;
+    Counter cacheEvictions;
+    Histogram compileTime;       // a compile request, cache lookup included
+    Histogram phaseTime[kPhases];
+
+    Counter runs[kRunEnds];
+    Counter limitsExceeded[5];   // by IRInterpreter::Limit
+    Counter instructions;        // added as each slice of a run ends
+    Counter outputBytes;
+    Histogram runTime;           // time spent executing, without waits for input or a worker
+
+    static Metrics& global();
+    // Back to zero, for a process whose warm-up work is not traffic
+    void clear();
+
+    // Prometheus text exposition format (version 0.0.4); histograms are
+    // written as summaries with their quantiles in seconds
+    std::string prometheus() const;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,44 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// --metrics-file=PATH and --metrics-port=PORT: publish Metrics::global() in
+// the Prometheus text format from a thread of its own, so the compiler's
+// threads only ever touch the atomics.
+//
+// The file is rewritten every kFileSeconds and once more when the exporter
+// stops, by writing PATH.tmp and renaming it over PATH, so a reader (say
+// node_exporter's textfile collector) never sees half of it. The port
+// answers GET /metrics over HTTP on 127.0.0.1; it is only available on
+// Linux.
+class MetricsExporter {
+public:
+    // An empty path or port 0 leaves that output off
+    MetricsExporter(const std::string& filePath, int port);
+    ~MetricsExporter();
+
+    // False, after saying why on stderr, if the port cannot be bound
+    bool start();
+
+private:
+    static const int kFileSeconds = 10;
+
+    void loop();
+    void writeFile();
+    void answer(int fd);
+
+    std::string filePath;
+    int port;
+    int listenFd = -1;
+    int wakeFd = -1;
+    bool stopping = false;
+    std::mutex stopMutex;
+    std::condition_variable stopped;
+    std::thread thread;
+};
+
+#endif // METRICS_EXPORTER_H
@@ -0,0 +1,74 @@
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Buffered writer for the JSON-lines events sent to the editor backend.
+// Events are escaped into one large buffer that is written out when asked
+// (before a READ prompt, at exit) or once it passes a size or age limit, so
+// a PRINT in a hot loop costs a memcpy rather than a syscall. The age is
+// checked as events arrive and, through flushIfStale(), by the interpreter
+// while it runs, so output followed by a long computation still shows.
+class OutputWriter {
+public:
+    // Receives whole event lines instead of the stream
+    using Sink = std::function<void(const std::string& lines)>;
+
+    explicit OutputWriter(std::FILE* stream = stdout);
+    ~OutputWriter();
+
+    void event(const std::string& type, const std::string& key, const std::string& value);
+    void flush();
+    // Flushes when something has waited longer than the age limit
+    void flushIfStale();
+    // Bytes of event values (printed text, prompts) so far, before escaping
+    unsigned long long bytesWritten() const { return written; }
+
+    // Tags every event with "session" (--serve runs many programs on one stdout)
+    void setSession(const std::string& id) { session = id; }
+    void setSink(Sink target) { sink = std::move(target); }
+
+    // Appends one event line to `out`; the session tag is left out when empty
+    static void appendEvent(std::string& out, const std::string& session, const std::string& type,
+                            const std::string& key, const std::string& value);
+    // Same with several string fields, in order
+    static void appendEvent(std::string& out, const std::string& session, const std::string& type,
+                            const std::vector<std::pair<std::string, std::string>>& fields);
+    // Appends `text` to `out` as the body of a JSON string literal
+    static void appendEscaped(std::string& out, const std::string& text);
+
+private:
+    static const size_t kFlushBytes = 1 << 16;
+    static const int kFlushMillis = 50;
+
+    std::FILE* stream;
+    Sink sink;
+    std::string session;
+    std::string buffer;
+    unsigned long long written = 0;
+    std::chrono::steady_clock::time_point lastFlush;
+};
+
+// Stream buffer for a run's runtime errors: each complete line is handed
+// to `emit` when the stream is flushed (the interpreter ends every message
+// with endl), so the caller can turn it into an event for its client.
+class LineEvents : public std::stringbuf {
+public:
+    using Emit = std::function<void(const std::string& line)>;
+
+    explicit LineEvents(Emit emit) : emit(std::move(emit)) {}
+
+protected:
+    int sync() override;
+
+private:
+    Emit emit;
+};
+
+#endif // OUTPUT_WRITER_H
@@ -1,15 +1,26 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <iostream>
 #include <vector>
 #include <memory>
+#include <stdexcept>
 #include "ast.h"
 #include "token.h"
 
+// Thrown when the parser cannot continue (a missing expected token). The
+// caller decides what that means: the one-shot compiler exits, --serve
+// fails only the session that submitted the code.
+class ParseError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 class Parser {
 private:
     std::vector<Token> tokens;
     size_t currentPos;
+    std::ostream& diagnostics;  // recoverable syntax errors
 
     // Token utilities
     Token currentToken();
@@ -40,7 +51,7 @@ private:
     std::vector<std::string> parseParameterList();
 
 public:
-    explicit Parser(std::vector<Token> tokens);
+    explicit Parser(std::vector<Token> tokens, std::ostream& diagnostics = std::cerr);
     std::unique_ptr<ASTNode> parse();
 };
 
@@ -0,0 +1,57 @@
+#ifndef RUN_ARENA_H
+#define RUN_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+// Memory for one run: blocks taken from the OS as the run needs them and
+// handed out by bumping a pointer. Nothing is freed piecemeal; the blocks
+// all go back when the arena is destroyed, at a cost set by their number
+// (a handful, as they double in size) rather than by how many objects the
+// run allocated, so containers placed here are simply never destroyed.
+//
+// With a quota the blocks never add up to more than that many bytes: an
+// allocation that would pass it throws Exhausted. Blocks are mapped
+// without touching them, so a run's resident memory stays below its quota.
+class RunArena : public std::pmr::memory_resource {
+public:
+    struct Exhausted : std::bad_alloc {
+        const char* what() const noexcept override { return "run memory quota exceeded"; }
+    };
+
+    // 0 means no quota
+    explicit RunArena(size_t quota = 0);
+    ~RunArena() override;
+    RunArena(const RunArena&) = delete;
+    RunArena& operator=(const RunArena&) = delete;
+
+    size_t quota() const { return quotaBytes; }
+    size_t reserved() const { return total; }
+
+private:
+    static const size_t kFirstBlock = 64 << 10;
+    static const size_t kMaxBlock = 16 << 20;
+
+    struct Block {
+        void* base;
+        size_t size;
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+    void* newBlock(size_t size);
+
+    std::vector<Block> blocks;
+    char* cursor = nullptr;      // free space of the newest small block
+    char* limit = nullptr;
+    size_t quotaBytes;
+    size_t total = 0;            // bytes in all blocks
+    size_t nextBlock = kFirstBlock;
+};
+
+#endif // RUN_ARENA_H
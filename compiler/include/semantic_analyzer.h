@@ -5,12 +5,16 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <iostream>
 
 class SemanticAnalyzer {
 public:
+    // Errors and warnings are written to `diagnostics`
+    explicit SemanticAnalyzer(std::ostream& diagnostics = std::cout) : diagnostics(diagnostics) {}
     void analyze(ASTNode* root);
 
 private:
+    std::ostream& diagnostics;
     std::unordered_map<std::string, std::string> symbolTable;
     std::unordered_set<std::string> functionTable;
     std::unordered_map<std::string, int> functionParamCount;
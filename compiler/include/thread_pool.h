@@ -0,0 +1,64 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own job deques. A worker takes
+// its jobs in order and, when its deques are empty, steals the oldest job of
+// another worker, so a few long programs in a batch do not leave the other
+// cores idle behind them. Jobs must not block on a user: a run waiting for
+// READ or past its time slice ends its job and is submitted again later.
+//
+// Interactive jobs are taken before any Batch job, on every worker, so
+// grading work queued behind an editor session never delays it by more
+// than the job already running. Every kBatchTurn-th job a worker takes is a
+// Batch one if any is queued, so busy editors slow grading but never
+// starve it.
+class ThreadPool {
+public:
+    enum class Priority { Interactive, Batch };
+
+    // 0 workers means one per hardware thread
+    explicit ThreadPool(unsigned workers = 0);
+    ~ThreadPool();
+
+    // From a worker the job goes to that worker's deque; from any other
+    // thread the deques are filled in turn
+    void submit(std::function<void()> job, Priority priority = Priority::Interactive);
+    // Blocks until every submitted job has finished
+    void wait();
+    unsigned size() const { return static_cast<unsigned>(threads.size()); }
+
+private:
+    static const unsigned kBatchTurn = 8;
+
+    struct Worker {
+        std::mutex dequeMutex;
+        std::deque<std::function<void()>> jobs[2];   // by Priority
+        unsigned taken = 0;                          // only used by its own thread
+    };
+
+    void work(unsigned index);
+    bool take(unsigned index, std::function<void()>& job);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned> nextWorker{0};
+
+    // Sleeping and waiting for idle; queued is only changed under this lock
+    std::mutex stateMutex;
+    std::condition_variable available;
+    std::condition_variable idle;
+    size_t queued = 0;        // in some deque
+    size_t pending = 0;       // queued or running
+    bool stopping = false;
+};
+
+#endif // THREAD_POOL_H
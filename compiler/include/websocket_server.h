@@ -0,0 +1,67 @@
+#ifndef WEBSOCKET_SERVER_H
+#define WEBSOCKET_SERVER_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "compile_cache.h"
+#include "compiler_server.h"
+
+// --websocket[=PORT]: speaks the editor's WebSocket protocol, the one
+// backend/src/server.js implements, directly on 127.0.0.1 so the browser
+// can skip the Node hop. A text message that is not JSON is code to run
+// (replacing the connection's current run); {"type":"input","value":V}
+// answers a READ. The server sends {"type":"output","message":...} and
+// {"type":"input","prompt":...}, the same lines the interpreter writes.
+//
+// One epoll loop owns every socket. Runs execute on their own threads and
+// hand finished frames to their connection's outbox, then wake the loop
+// through an eventfd. The loop never waits for a run: a replaced run is
+// cancelled and its successor's thread waits for it before starting, and
+// the run of a closed connection is joined once it reports that it is done.
+// Only built on Linux; elsewhere serve() reports that and fails.
+class WebSocketServer {
+public:
+    WebSocketServer(const ServeOptions& options, int port);
+    ~WebSocketServer();
+
+    int serve();
+
+private:
+    struct Connection;
+    struct Run;
+
+    static const size_t kMaxMessage = 1 << 20;   // larger client messages close the connection
+    static const size_t kMaxOutbox = 8 << 20;
+
+    void acceptConnections();
+    bool receive(Connection& connection);
+    bool handshake(Connection& connection);
+    bool readFrames(Connection& connection);
+    void onMessage(Connection& connection, const std::string& text);
+    void startRun(Connection& connection, const std::string& code);
+    void runProgram(Connection& connection, Run& run, const std::string& code);
+    // Cancels the connection's run without waiting for it
+    void stopRun(Connection& connection);
+    // Appends raw bytes to the outbox; a run thread (`waiter`) first blocks
+    // while the client is more than kMaxOutbox behind, until it is cancelled
+    void queue(Connection& connection, const std::string& bytes, const Run* waiter = nullptr);
+    void sendText(Connection& connection, const std::string& text);
+    bool flushOutbox(Connection& connection);
+    void closeConnection(int fd);
+    // Joins the runs of closed connections that have finished
+    void reapRuns(bool wait);
+    void wake();
+
+    ServeOptions options;
+    int port;
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::unique_ptr<CompileCache> cache;
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;   // runs share them
+    std::vector<std::shared_ptr<Run>> closedRuns;   // of closed connections, not yet joined
+};
+
+#endif // WEBSOCKET_SERVER_H
@@ -0,0 +1,154 @@
+#include "batch_runner.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "compiler_session.h"
+#include "input_channel.h"
+#include "thread_pool.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+double millisSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+}
+
+BatchRunner::BatchRunner(const ServeOptions& options, unsigned workers)
+    : options(options), workers(workers) {
+    if (!options.cacheDir.empty())
+        cache = make_unique<CompileCache>(options.cacheDir, options.cacheBytes);
+}
+
+bool BatchRunner::collect(const string& path, vector<Job>& jobs) {
+    error_code ec;
+    if (fs::is_directory(path, ec)) {
+        for (fs::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec) && it->path().extension() == ".txt") {
+                Job job;
+                job.program = it->path().string();
+                jobs.push_back(job);
+            }
+        }
+        // Directory order is arbitrary; keep the summary stable
+        sort(jobs.begin(), jobs.end(),
+             [](const Job& a, const Job& b) { return a.program < b.program; });
+        return !ec;
+    }
+
+    ifstream manifest(path);
+    if (!manifest) return false;
+    fs::path base = fs::path(path).parent_path();
+    string line;
+    while (getline(manifest, line)) {
+        size_t comment = line.find('#');
+        if (comment != string::npos) line.erase(comment);
+        istringstream fields(line);
+        string program, input;
+        if (!(fields >> program)) continue;
+        fields >> input;
+        Job job;
+        job.program = (base / program).string();
+        if (!input.empty()) job.input = (base / input).string();
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// Runs on a pool worker; everything it touches besides the cache is its own
+void BatchRunner::runJob(Job& job) {
+    ifstream source(job.program);
+    if (!source) {
+        job.status = "unreadable";
+        return;
+    }
+    string code(istreambuf_iterator<char>(source), {});
+
+    fs::path stem = fs::path(job.program).replace_extension();
+    string inputPath = job.input.empty() ? stem.string() + ".in" : job.input;
+    QueueInputChannel input;
+    ifstream values(inputPath);
+    string value;
+    while (getline(values, value)) {
+        if (!value.empty() && value.back() == '\r') value.pop_back();
+        if (!value.empty()) input.push(value);
+    }
+    input.close();  // a READ past the last value fails instead of waiting
+
+    string outputPath = stem.string() + ".out";
+    string errorPath = stem.string() + ".err";
+    FILE* out = fopen(outputPath.c_str(), "wb");
+    ostringstream errors;
+
+    CompilerSession session;
+    session.setDispatchMode(options.dispatchMode);
+    session.setQuickening(options.quickening);
+    session.setMemoization(options.memoization);
+    session.setCache(cache.get());
+    session.setLimits(options.limits);
+    session.setDiagnostics(errors);
+    session.setErrorStream(errors);
+    session.setInputChannel(&input);
+    session.setOutputSink([out](const string& lines) {
+        if (out) fwrite(lines.data(), 1, lines.size(), out);
+    });
+
+    auto start = chrono::steady_clock::now();
+    shared_ptr<const IRProgram> program = session.compile(code);
+    job.compileMs = millisSince(start);
+    if (!program) {
+        errors << session.compileError() << '\n';
+        job.status = "compile-error";
+    } else {
+        size_t compileErrors = errors.tellp();
+        start = chrono::steady_clock::now();
+        IRInterpreter::RunStatus status = session.run(program);
+        job.runMs = millisSince(start);
+        if (status == IRInterpreter::RunStatus::LimitExceeded) {
+            errors << "[ERROR] Run stopped: " << IRInterpreter::limitName(session.exceededLimit())
+                   << " limit exceeded" << '\n';
+            job.status = "limit-exceeded";
+        } else {
+            job.status = static_cast<size_t>(errors.tellp()) > compileErrors ? "runtime-error" : "ok";
+        }
+    }
+    if (out) fclose(out);
+
+    string messages = errors.str();
+    if (messages.empty()) {
+        remove(errorPath.c_str());  // left by an earlier batch
+    } else {
+        ofstream(errorPath) << messages;
+    }
+}
+
+int BatchRunner::run(const string& path) {
+    vector<Job> jobs;
+    if (!collect(path, jobs)) {
+        cerr << "Cannot read batch: " << path << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    ThreadPool pool(workers);
+    for (Job& job : jobs) pool.submit([this, &job] { runJob(job); });
+    pool.wait();
+    double wallMs = millisSince(start);
+
+    size_t ok = 0;
+    double cpuMs = 0;
+    for (const Job& job : jobs) {
+        printf("%-14s %9.2f ms compile %9.2f ms run  %s\n", job.status.c_str(),
+               job.compileMs, job.runMs, job.program.c_str());
+        if (job.status == "ok") ok++;
+        cpuMs += job.compileMs + job.runMs;
+    }
+    printf("%zu programs, %zu ok, %zu failed; %.1f ms wall, %.1f ms summed, %u workers\n",
+           jobs.size(), ok, jobs.size() - ok, wallMs, cpuMs, pool.size());
+    return ok == jobs.size() ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+#include "compile_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+#include "metrics.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+#ifndef PSEUDO_COMPILER_VERSION
+#define PSEUDO_COMPILER_VERSION "dev"
+#endif
+
+CompileCache::CompileCache(const string& directory, uintmax_t maxBytes)
+    : directory(directory), maxBytes(maxBytes) {
+    error_code ec;
+    fs::create_directories(directory, ec);
+    if (!fs::is_directory(directory, ec)) {
+        cerr << "[WARNING] Compile cache disabled, cannot create " << directory << endl;
+        usable = false;
+        return;
+    }
+    listEntries(totalBytes);
+}
+
+// The key covers everything that decides the decoded program: the source,
+// the compiler release and the binary IR format. The runtime options
+// (dispatch, quickening, memoisation) are applied when the program runs.
+string CompileCache::pathFor(const string& source) const {
+    uint64_t h = 1469598103934665603ULL;
+    auto mix = [&h](const string& text) {
+        for (unsigned char c : text) h = (h ^ c) * 1099511628211ULL;
+        h = (h ^ 0xff) * 1099511628211ULL;  // separator
+    };
+    mix(PSEUDO_COMPILER_VERSION);
+    mix(to_string(IRProgram::kFormatVersion));
+    mix(source);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.psir", static_cast<unsigned long long>(h));
+    return (fs::path(directory) / name).string();
+}
+
+shared_ptr<IRProgram> CompileCache::lookup(const string& source) {
+    if (!usable) return nullptr;
+    lock_guard<mutex> lock(cacheMutex);
+    string path = pathFor(source);
+    error_code ec;
+    if (!fs::exists(path, ec)) {
+        counters.misses++;
+        return nullptr;
+    }
+
+    string error;
+    shared_ptr<IRProgram> program = IRProgram::load(path, error);
+    if (!program) {
+        // Left by an older build or damaged: compile again and overwrite it
+        counters.misses++;
+        return nullptr;
+    }
+    if (program->source != source) {
+        // Another source with the same key: compile this one and take the slot
+        counters.misses++;
+        return nullptr;
+    }
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    counters.hits++;
+    return program;
+}
+
+void CompileCache::store(const string& source, const IRProgram& program) {
+    if (!usable) return;
+    lock_guard<mutex> lock(cacheMutex);
+    string path = pathFor(source);
+    error_code ec;
+    uintmax_t replaced = fs::exists(path, ec) ? fs::file_size(path, ec) : 0;
+    if (ec) replaced = 0;
+    string error;
+    if (!program.save(path, error)) {
+        cerr << "[WARNING] Compile cache: " << error << endl;
+        return;
+    }
+    uintmax_t written = fs::file_size(path, ec);
+    if (ec) written = 0;
+    totalBytes = totalBytes - min(totalBytes, replaced) + written;
+    evict();
+}
+
+CompileCache::Stats CompileCache::stats() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return counters;
+}
+
+// Entries other processes sharing the directory add or remove are only seen
+// when the running total crosses the bound and the directory is listed again.
+vector<CompileCache::Entry> CompileCache::listEntries(uintmax_t& total) const {
+    vector<Entry> entries;
+    total = 0;
+    error_code ec;
+    for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".psir") continue;
+        Entry entry{it->path(), it->file_size(ec), it->last_write_time(ec)};
+        if (ec) continue;  // removed by another process meanwhile
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+void CompileCache::evict() {
+    if (totalBytes <= maxBytes) return;
+    vector<Entry> entries = listEntries(totalBytes);
+    if (totalBytes <= maxBytes) return;
+
+    sort(entries.begin(), entries.end(),
+         [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    error_code ec;
+    for (const Entry& entry : entries) {
+        if (totalBytes <= maxBytes) break;
+        if (fs::remove(entry.path, ec)) {
+            counters.evictions++;
+            Metrics::global().cacheEvictions.add();
+        }
+        totalBytes -= entry.size;
+    }
+}
@@ -0,0 +1,72 @@
+#include "compiler.h"
+#include <fstream>
+#include <vector>
+#include "lexer.h"
+#include "parser.h"
+#include "semantic_analyzer.h"
+#include "ir_generator.h"
+#include "ir_optimizer.h"
+#include "ir_decoder.h"
+#include "metrics.h"
+
+using namespace std;
+
+static void printAST(const unique_ptr<ASTNode>& node, ostream& parsedFile, int depth = 0) {
+    for (int i = 0; i < depth; i++) parsedFile << "  ";
+    parsedFile << node->type << ": " << node->value << '\n';
+    for (const auto& child : node->children) {
+        printAST(child, parsedFile, depth + 1);
+    }
+}
+
+shared_ptr<IRProgram> compileSource(const string& source, ostream& diagnostics,
+                                    const CompileDumps* dumps) {
+    Metrics& metrics = Metrics::global();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // Lexing
+    Lexer lexer(source, diagnostics);
+    vector<Token> tokens = lexer.tokenize();
+    start = metrics.phaseTime[Metrics::Lex].recordSince(start);
+
+    // Write tokens to file
+    if (dumps && !dumps->tokens.empty()) {
+        ofstream tokenFile(dumps->tokens);
+        for (const Token& token : tokens) {
+            tokenFile << token.type << " -> " << token.value << '\n';
+        }
+    }
+
+    // Parsing
+    Parser parser(tokens, diagnostics);
+    unique_ptr<ASTNode> root = parser.parse();
+    start = metrics.phaseTime[Metrics::Parse].recordSince(start);
+
+    // Print AST
+    if (dumps && !dumps->ast.empty()) {
+        ofstream astFile(dumps->ast);
+        printAST(root, astFile);
+    }
+
+    // Semantic Analysis
+    SemanticAnalyzer semanticAnalyzer(diagnostics);
+    semanticAnalyzer.analyze(root.get());
+    start = metrics.phaseTime[Metrics::Semantic].recordSince(start);
+
+    // IR Generation
+    IRGenerator irGen;
+    IRModule ir = irGen.generate(root.get());
+    start = metrics.phaseTime[Metrics::Generate].recordSince(start);
+    if (dumps && !dumps->ir.empty()) ir.dump(dumps->ir);
+
+    // IR Optimization
+    IROptimizer optimizer;
+    IRModule optimizedIr = optimizer.optimize(ir);
+    start = metrics.phaseTime[Metrics::Optimize].recordSince(start);
+    if (dumps && !dumps->optimizedIr.empty()) optimizedIr.dump(dumps->optimizedIr);
+
+    // Decoding (labels, slots, fusion)
+    shared_ptr<IRProgram> program = IRDecoder().decode(optimizedIr);
+    metrics.phaseTime[Metrics::Decode].recordSince(start);
+    return program;
+}
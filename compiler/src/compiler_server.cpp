@@ -0,0 +1,295 @@
+#include "compiler_server.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include "compiler_session.h"
+#include "json_line.h"
+#include "output_writer.h"
+#ifdef __linux__
+#include <time.h>
+#endif
+
+using namespace std;
+
+namespace {
+// CPU time of the calling thread; a slice runs on one thread from start to
+// end. Elsewhere wall time, which a busy machine inflates.
+unsigned long long threadCpuMicros() {
+#ifdef __linux__
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+#else
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+string millis(unsigned long long micros) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", micros / 1000.0);
+    return text;
+}
+}
+
+IRInterpreter::Limits requestLimits(const ServeOptions& options,
+                                    const unordered_map<string, string>& request) {
+    IRInterpreter::Limits limits = options.limits;
+    auto limit = [&request](const char* key, unsigned long long& value) {
+        auto it = request.find(key);
+        if (it != request.end()) value = strtoull(it->second.c_str(), nullptr, 10);
+    };
+    limit("maxInstructions", limits.instructions);
+    limit("maxTimeMs", limits.milliseconds);
+    limit("maxOutputBytes", limits.outputBytes);
+    limit("maxMemoryBytes", limits.memoryBytes);
+    return limits;
+}
+
+CompilerServer::CompilerServer(const ServeOptions& options, unsigned workers)
+    : options(options), workers(workers) {
+    if (!options.cacheDir.empty())
+        cache = make_unique<CompileCache>(options.cacheDir, options.cacheBytes);
+}
+
+CompilerServer::~CompilerServer() {
+    for (auto& entry : sessions) stopRun(entry.first, *entry.second);
+    for (auto& entry : closed) stopRun(entry.first, *entry.second);
+}
+
+int CompilerServer::serve(istream& in) {
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) handle(line);
+    }
+    for (auto& entry : sessions) stopRun(entry.first, *entry.second);
+    for (auto& entry : closed) stopRun(entry.first, *entry.second);
+    closed.clear();
+    return 0;
+}
+
+void CompilerServer::handle(const string& line) {
+    unordered_map<string, string> request;
+    if (!parseJsonLine(line, request)) {
+        reply("", "error", "message", "Malformed request: " + line);
+        return;
+    }
+    const string& op = request["op"];
+    const string& id = request["session"];
+    if (id.empty()) {
+        reply("", "error", "message", "Request without a session: " + line);
+        return;
+    }
+
+    reapClosed();
+    if (op == "close") {
+        auto it = sessions.find(id);
+        if (it != sessions.end()) {
+            cancelRun(id, *it->second);
+            if (isRunning(*it->second)) closed.emplace_back(id, move(it->second));
+            sessions.erase(it);
+        }
+        return;
+    }
+
+    unique_ptr<Session>& slot = sessions[id];
+    if (!slot) slot = make_unique<Session>();
+    Session& session = *slot;
+
+    if (op == "compile") {
+        compile(id, session, request["code"]);
+    } else if (op == "run") {
+        if (isRunning(session)) {
+            reply(id, "error", "message", "A run is already in progress");
+        } else if (request.count("code") && !compile(id, session, request["code"])) {
+            reply(id, "exit", "status", "failed");
+        } else {
+            startRun(id, session, request);
+        }
+    } else if (op == "input") {
+        if (!isRunning(session)) {
+            reply(id, "error", "message", "No run is waiting for input");
+            return;
+        }
+        session.input->push(request["value"]);
+        lock_guard<mutex> lock(session.stateMutex);
+        if (session.waiting) resumeRun(id, session);
+    } else if (op == "cancel") {
+        if (isRunning(session)) cancelRun(id, session);
+        else reply(id, "error", "message", "No run in progress");
+    } else if (op == "stats") {
+        vector<pair<string, string>> fields = usage(session);
+        {
+            lock_guard<mutex> lock(session.stateMutex);
+            fields.insert(fields.begin(), {"state", !session.running ? "idle"
+                                                    : session.waiting ? "waiting" : "running"});
+        }
+        fields.emplace_back("sessionCpuMs", millis(session.totalCpuMicros));
+        reply(id, "stats", fields);
+    } else {
+        reply(id, "error", "message", "Unknown op: " + op);
+    }
+}
+
+bool CompilerServer::compile(const string& id, Session& session, const string& code) {
+    session.program.reset();
+    CompilerSession compiler;
+    compiler.setCache(cache.get());
+    ostringstream diagnostics;
+    compiler.setDiagnostics(diagnostics);
+    shared_ptr<const IRProgram> program = compiler.compile(code);
+    // Diagnostics do not stop compilation; show them like program output
+    istringstream lines(diagnostics.str());
+    string message;
+    while (getline(lines, message)) reply(id, "output", "message", message);
+    if (!program) {
+        reply(id, "error", "message", compiler.compileError());
+        return false;
+    }
+
+    static const char* const cacheResults[] = {"off", "hit", "miss"};
+    session.program = program;
+    reply(id, "compiled", "cache", cacheResults[static_cast<int>(compiler.cacheResult())]);
+    return true;
+}
+
+void CompilerServer::startRun(const string& id, Session& session,
+                              const unordered_map<string, string>& request) {
+    if (!session.program) {
+        reply(id, "error", "message", "Nothing compiled in this session");
+        reply(id, "exit", "status", "failed");
+        return;
+    }
+
+    session.input = make_unique<QueueInputChannel>();
+    session.cancel = false;
+    session.runner.reset();
+    session.errorEvents = make_unique<LineEvents>(
+        [this, id](const string& line) { reply(id, "error", "message", line); });
+    session.errors = make_unique<ostream>(session.errorEvents.get());
+    session.runner = make_unique<CompilerSession>();
+    CompilerSession& runner = *session.runner;
+    runner.setDispatchMode(options.dispatchMode);
+    runner.setQuickening(options.quickening);
+    runner.setMemoization(options.memoization);
+    runner.setInputChannel(session.input.get());
+    runner.setCancelFlag(&session.cancel);
+    runner.setSuspendOnRead(true);
+    runner.setSliceBudget(options.sliceInstructions);
+    runner.setLimits(requestLimits(options, request));
+    runner.setOutputSession(id);
+    runner.setErrorStream(*session.errors);
+    auto priority = request.find("priority");
+    session.priority = priority != request.end() && priority->second == "batch"
+                           ? ThreadPool::Priority::Batch : ThreadPool::Priority::Interactive;
+    session.instructions = 0;
+    session.slices = 0;
+    session.runCpuMicros = 0;
+    {
+        lock_guard<mutex> lock(session.stateMutex);
+        session.running = true;
+        session.waiting = false;
+    }
+    shared_ptr<const IRProgram> program = session.program;  // a compile may replace it meanwhile
+    workers.submit([this, id, &session, program] { runSlice(id, session, program); },
+                   session.priority);
+}
+
+void CompilerServer::resumeRun(const string& id, Session& session) {
+    session.waiting = false;
+    workers.submit([this, id, &session] { runSlice(id, session, nullptr); }, session.priority);
+}
+
+void CompilerServer::runSlice(const string& id, Session& session,
+                              const shared_ptr<const IRProgram>& program) {
+    unsigned long long start = threadCpuMicros();
+    IRInterpreter::RunStatus status = program ? session.runner->run(program)
+                                              : session.runner->resume();
+    unsigned long long used = threadCpuMicros() - start;
+    session.runCpuMicros += used;
+    session.totalCpuMicros += used;
+    session.slices++;
+    session.instructions = session.runner->instructionCount();
+    afterSlice(id, session, status);
+}
+
+// On a worker, once the run has ended, suspended or used up its slice
+void CompilerServer::afterSlice(const string& id, Session& session, IRInterpreter::RunStatus status) {
+    if (status == IRInterpreter::RunStatus::Preempted) {
+        lock_guard<mutex> lock(session.stateMutex);
+        resumeRun(id, session);   // behind every run queued meanwhile
+        return;
+    }
+    if (status == IRInterpreter::RunStatus::WaitingForInput) {
+        lock_guard<mutex> lock(session.stateMutex);
+        // Input (or a cancel) that arrived while the run was suspending
+        if (session.input->hasInput() || session.cancel) resumeRun(id, session);
+        else session.waiting = true;
+        return;
+    }
+
+    vector<pair<string, string>> fields = usage(session);
+    if (status == IRInterpreter::RunStatus::LimitExceeded) {
+        fields.insert(fields.begin(), {{"status", "limit-exceeded"},
+                                       {"limit", IRInterpreter::limitName(session.runner->exceededLimit())}});
+    } else {
+        fields.insert(fields.begin(),
+                      {"status", status == IRInterpreter::RunStatus::Finished ? "finished" : "cancelled"});
+    }
+    reply(id, "exit", fields);
+    lock_guard<mutex> lock(session.stateMutex);
+    session.running = false;
+    session.stopped.notify_all();
+}
+
+void CompilerServer::cancelRun(const string& id, Session& session) {
+    session.cancel = true;
+    if (session.input) session.input->close();
+    lock_guard<mutex> lock(session.stateMutex);
+    if (session.running && session.waiting) resumeRun(id, session);  // no worker would notice the cancel otherwise
+}
+
+void CompilerServer::stopRun(const string& id, Session& session) {
+    cancelRun(id, session);
+    unique_lock<mutex> lock(session.stateMutex);
+    session.stopped.wait(lock, [&session] { return !session.running; });
+}
+
+void CompilerServer::reapClosed() {
+    closed.erase(remove_if(closed.begin(), closed.end(),
+                           [this](const pair<string, unique_ptr<Session>>& entry) {
+                               return !isRunning(*entry.second);
+                           }),
+                 closed.end());
+}
+
+bool CompilerServer::isRunning(Session& session) {
+    lock_guard<mutex> lock(session.stateMutex);
+    return session.running;
+}
+
+// Of the current run, or the last one when idle
+vector<pair<string, string>> CompilerServer::usage(const Session& session) {
+    return {{"instructions", to_string(session.instructions)},
+            {"slices", to_string(session.slices)},
+            {"cpuMs", millis(session.runCpuMicros)}};
+}
+
+void CompilerServer::reply(const string& id, const string& type,
+                           const string& key, const string& value) {
+    string event;
+    OutputWriter::appendEvent(event, id, type, key, value);
+    fwrite(event.data(), 1, event.size(), stdout);
+    fflush(stdout);
+}
+
+void CompilerServer::reply(const string& id, const string& type,
+                           const vector<pair<string, string>>& fields) {
+    string event;
+    OutputWriter::appendEvent(event, id, type, fields);
+    fwrite(event.data(), 1, event.size(), stdout);
+    fflush(stdout);
+}
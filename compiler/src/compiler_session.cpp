@@ -0,0 +1,77 @@
+#include "compiler_session.h"
+#include "metrics.h"
+#include "parser.h"
+#include <sstream>
+
+using namespace std;
+
+shared_ptr<const IRProgram> CompilerSession::compile(const string& source, const CompileDumps* dumps) {
+    Metrics& metrics = Metrics::global();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    metrics.compiles.add();
+    error.clear();
+    cached = CacheResult::Off;
+    shared_ptr<IRProgram> program;
+    if (cache && !dumps) {
+        program = cache->lookup(source);
+        cached = program ? CacheResult::Hit : CacheResult::Miss;
+        (program ? metrics.cacheHits : metrics.cacheMisses).add();
+        if (program) {
+            *diagnostics << program->diagnostics;
+            metrics.compileTime.recordSince(start);
+            return program;
+        }
+    }
+
+    // Kept with a cached program, so a hit shows the same warnings
+    ostringstream captured;
+    try {
+        program = compileSource(source, cache ? captured : *diagnostics, dumps);
+    } catch (const ParseError& e) {
+        *diagnostics << captured.str();
+        error = e.what();
+        metrics.compileErrors.add();
+        metrics.compileTime.recordSince(start);
+        return nullptr;
+    }
+    if (cache) {
+        *diagnostics << captured.str();
+        program->setDiagnostics(captured.str());
+        program->setSource(source);
+        cache->store(source, *program);
+    }
+    metrics.compileTime.recordSince(start);
+    return program;
+}
+
+IRInterpreter::RunStatus CompilerSession::run(const shared_ptr<const IRProgram>& program) {
+    interpreter = make_unique<IRInterpreter>();
+    interpreter->setDispatchMode(dispatchMode);
+    interpreter->setQuickening(quickening);
+    interpreter->setMemoization(memoization);
+    interpreter->setInputChannel(input);
+    interpreter->setCancelFlag(cancelFlag);
+    interpreter->setErrorStream(*errors);
+    interpreter->setSuspendOnRead(suspendOnRead);
+    interpreter->setSliceBudget(sliceBudget);
+    interpreter->setLimits(limits);
+    interpreter->setOutputSession(outputSession);
+    if (outputSink) interpreter->setOutputSink(outputSink);
+    return finish(interpreter->run(program));
+}
+
+IRInterpreter::RunStatus CompilerSession::resume() {
+    return finish(interpreter->resume());
+}
+
+// A run that is over releases its interpreter (frames, slots, memo table)
+IRInterpreter::RunStatus CompilerSession::finish(IRInterpreter::RunStatus status) {
+    memo = interpreter->memoStats();
+    instructions = interpreter->instructionCount();
+    exceeded = interpreter->exceededLimit();
+    reportedError = interpreter->errorReported();
+    if (status != IRInterpreter::RunStatus::WaitingForInput &&
+        status != IRInterpreter::RunStatus::Preempted)
+        interpreter.reset();
+    return status;
+}
@@ -0,0 +1,275 @@
+#include "fork_server.h"
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include "compile_cache.h"
+#include "compiler_session.h"
+#include "input_channel.h"
+#include "json_line.h"
+#include "metrics.h"
+#include "output_writer.h"
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifndef __linux__
+
+ForkServer::ForkServer(const ServeOptions& options, const string& socketPath, unsigned workers)
+    : options(options), socketPath(socketPath), workers(workers) {}
+
+int ForkServer::serve() {
+    cerr << "--fork-server is only available on Linux" << endl;
+    return 1;
+}
+
+#else
+
+namespace {
+
+volatile sig_atomic_t stopSignal = 0;
+
+void onStopSignal(int) {
+    stopSignal = 1;
+}
+
+bool sendAll(int fd, const string& bytes) {
+    size_t sent = 0;
+    while (sent < bytes.size()) {
+        ssize_t n = send(fd, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;  // the client went away; the run still finishes
+        sent += n;
+    }
+    return true;
+}
+
+void sendEvent(int fd, const string& type, const string& key, const string& value) {
+    string event;
+    OutputWriter::appendEvent(event, "", type, key, value);
+    sendAll(fd, event);
+}
+
+// Request lines from the client
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd(fd) {}
+
+    bool next(string& line) {
+        for (;;) {
+            size_t end = buffer.find('\n');
+            if (end != string::npos) {
+                line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                return true;
+            }
+            char chunk[4096];
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buffer.append(chunk, n);
+        }
+    }
+
+private:
+    int fd;
+    string buffer;
+};
+
+}
+
+ForkServer::ForkServer(const ServeOptions& options, const string& socketPath, unsigned workers)
+    : options(options), socketPath(socketPath),
+      workers(workers ? workers : max(1u, thread::hardware_concurrency())) {}
+
+// Everything built lazily on first use gets built here, before any fork:
+// keyword table, the decoder's operator table, quickening tables, and
+// heap arenas grown to a compile's working size. The warm-up run is then
+// taken back out of the metrics.
+void ForkServer::warmUp() {
+    static const char* const program =
+        "START\n"
+        "FUNCTION add(a, b)\n  c = a + b\n  RETURN c\nENDFUNCTION\n"
+        "i = 0\n"
+        "WHILE i < 3 DO\n  i = add(i, 1)\nENDWHILE\n"
+        "IF i > 2 THEN\n  PRINT i\nENDIF\n"
+        "END\n";
+    CompilerSession session;
+    ostringstream discarded;
+    session.setDiagnostics(discarded);
+    session.setErrorStream(discarded);
+    session.setOutputSink([](const string&) {});
+    shared_ptr<const IRProgram> compiled = session.compile(program);
+    if (compiled) session.run(compiled);
+    Metrics::global().clear();
+}
+
+int ForkServer::serve() {
+    warmUp();
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Socket path too long: " << socketPath << endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    unlink(socketPath.c_str());  // left by a server that did not shut down
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listenFd, SOMAXCONN) < 0) {
+        cerr << "Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    // Without SA_RESTART, so waitpid() below returns to check the flag
+    struct sigaction action {};
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    cerr << "Fork server listening on " << socketPath << " with " << workers << " workers" << endl;
+    for (unsigned i = 0; i < workers; ++i) spawnWorker();
+
+    // Every worker that exits, after its job or by crashing, is replaced
+    while (!stopSignal && !children.empty()) {
+        pid_t pid = waitpid(-1, nullptr, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        children.erase(pid);
+        if (!stopSignal) spawnWorker();
+    }
+
+    for (int pid : children) kill(pid, SIGTERM);
+    while (!children.empty()) {
+        pid_t pid = waitpid(-1, nullptr, 0);
+        if (pid > 0) children.erase(pid);
+        else if (errno != EINTR) break;
+    }
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return 0;
+}
+
+bool ForkServer::spawnWorker() {
+    pid_t pid = fork();
+    if (pid < 0) {
+        cerr << "fork failed: " << strerror(errno) << endl;
+        return false;
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        serveJob();
+        _exit(0);  // the parent's state is not this process's to clean up
+    }
+    children.insert(pid);
+    return true;
+}
+
+// In a worker: one connection, then the process ends
+void ForkServer::serveJob() {
+    int fd;
+    do {
+        fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    } while (fd < 0 && (errno == EINTR || errno == ECONNABORTED));
+    if (fd < 0) _exit(1);
+    close(listenFd);
+    runJob(fd);
+    close(fd);
+}
+
+void ForkServer::runJob(int fd) {
+    LineReader reader(fd);
+    string line;
+    unordered_map<string, string> request;
+    if (!reader.next(line)) return;
+    if (!parseJsonLine(line, request) || request["op"] != "run") {
+        sendEvent(fd, "error", "message", "Expected a run request: " + line);
+        sendEvent(fd, "exit", "status", "failed");
+        return;
+    }
+
+    CompilerSession session;
+    session.setDispatchMode(options.dispatchMode);
+    session.setQuickening(options.quickening);
+    session.setMemoization(options.memoization);
+    unique_ptr<CompileCache> cache;
+    if (!options.cacheDir.empty()) {
+        cache = make_unique<CompileCache>(options.cacheDir, options.cacheBytes);
+        session.setCache(cache.get());
+    }
+    ostringstream diagnostics;
+    session.setDiagnostics(diagnostics);
+    shared_ptr<const IRProgram> program = session.compile(request["code"]);
+    istringstream lines(diagnostics.str());
+    string message;
+    while (getline(lines, message)) sendEvent(fd, "output", "message", message);
+    if (!program) {
+        sendEvent(fd, "error", "message", session.compileError());
+        sendEvent(fd, "exit", "status", "failed");
+        return;
+    }
+    static const char* const cacheResults[] = {"off", "hit", "miss"};
+    sendEvent(fd, "compiled", "cache", cacheResults[static_cast<int>(session.cacheResult())]);
+
+    QueueInputChannel input;
+    atomic<bool> cancel{false};
+    LineEvents errorEvents([fd](const string& line) { sendEvent(fd, "error", "message", line); });
+    ostream errors(&errorEvents);
+    session.setLimits(requestLimits(options, request));
+    session.setInputChannel(&input);
+    session.setCancelFlag(&cancel);
+    session.setErrorStream(errors);
+    session.setOutputSink([fd](const string& events) { sendAll(fd, events); });
+
+    // Input and cancel requests arrive while the program runs
+    thread requests([&reader, &input, &cancel] {
+        string next;
+        unordered_map<string, string> fields;
+        while (reader.next(next)) {
+            fields.clear();
+            if (!parseJsonLine(next, fields)) continue;
+            if (fields["op"] == "input") {
+                input.push(fields["value"]);
+            } else if (fields["op"] == "cancel") {
+                cancel = true;
+                break;
+            }
+        }
+        input.close();
+    });
+
+    IRInterpreter::RunStatus status = session.run(program);
+    errors.flush();
+    vector<pair<string, string>> fields;
+    if (status == IRInterpreter::RunStatus::LimitExceeded) {
+        fields = {{"status", "limit-exceeded"},
+                  {"limit", IRInterpreter::limitName(session.exceededLimit())}};
+    } else {
+        fields = {{"status", status == IRInterpreter::RunStatus::Finished ? "finished" : "cancelled"}};
+    }
+    fields.emplace_back("instructions", to_string(session.instructionCount()));
+    string event;
+    OutputWriter::appendEvent(event, "", "exit", fields);
+    sendAll(fd, event);
+
+    shutdown(fd, SHUT_RDWR);  // ends the request thread's read
+    requests.join();
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include "grade_runner.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include "compiler_session.h"
+#include "input_channel.h"
+#include "json_line.h"
+#include "lockstep_interpreter.h"
+#include "thread_pool.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+vector<string> readLines(const string& path) {
+    vector<string> lines;
+    ifstream in(path);
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        lines.push_back(line);
+    }
+    while (!lines.empty() && lines.back().empty()) lines.pop_back();
+    return lines;
+}
+
+// Scripted READ values; a READ past the last one fails instead of waiting
+void loadInput(QueueInputChannel& input, const string& path) {
+    for (const string& value : readLines(path))
+        if (!value.empty()) input.push(value);
+    input.close();
+}
+
+// Keeps only the PRINT messages; prompts are not part of the answer
+OutputWriter::Sink collectPrinted(vector<string>& printed) {
+    return [&printed](const string& lines) {
+        unordered_map<string, string> event;
+        size_t begin = 0, end;
+        while ((end = lines.find('\n', begin)) != string::npos) {
+            event.clear();
+            if (parseJsonLine(lines.substr(begin, end - begin), event) && event["type"] == "output")
+                printed.push_back(event["message"]);
+            begin = end + 1;
+        }
+    };
+}
+
+double millisSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+}
+
+GradeRunner::GradeRunner(const ServeOptions& options, unsigned workers)
+    : options(options), workers(workers) {}
+
+void GradeRunner::judge(Case& testCase, vector<string>& printed, const string& errors,
+                        IRInterpreter::Limit exceeded) {
+    if (exceeded != IRInterpreter::Limit::None) {
+        testCase.verdict = "limit-exceeded";
+        testCase.detail = string(IRInterpreter::limitName(exceeded)) + " limit";
+        return;
+    }
+    if (!errors.empty()) {
+        testCase.verdict = "runtime-error";
+        testCase.detail = errors.substr(0, errors.find('\n'));
+        return;
+    }
+    while (!printed.empty() && printed.back().empty()) printed.pop_back();
+    vector<string> expected = readLines(testCase.expectedPath);
+    size_t line = 0;
+    while (line < printed.size() && line < expected.size() && printed[line] == expected[line]) line++;
+    if (line == printed.size() && line == expected.size()) {
+        testCase.verdict = "pass";
+        return;
+    }
+    testCase.verdict = "wrong-answer";
+    testCase.detail = "line " + to_string(line + 1) + ": expected " +
+                      (line < expected.size() ? "\"" + expected[line] + "\"" : string("end of output")) +
+                      ", got " +
+                      (line < printed.size() ? "\"" + printed[line] + "\"" : string("end of output"));
+}
+
+// Runs on a pool worker with its own input, output and interpreter
+void GradeRunner::runCase(Case& testCase) {
+    QueueInputChannel input;
+    loadInput(input, testCase.inputPath);
+    vector<string> printed;
+    ostringstream errors;
+    CompilerSession session;
+    session.setDispatchMode(options.dispatchMode);
+    session.setQuickening(options.quickening);
+    session.setMemoization(options.memoization);
+    session.setErrorStream(errors);
+    session.setLimits(options.limits);
+    session.setInputChannel(&input);
+    session.setOutputSink(collectPrinted(printed));
+
+    auto start = chrono::steady_clock::now();
+    session.run(program);
+    testCase.runMs = millisSince(start);
+    testCase.instructions = session.instructionCount();
+    judge(testCase, printed, errors.str(), session.exceededLimit());
+}
+
+// Runs a group of cases as the lanes of one lockstep run; each case is
+// charged the wall time of the whole group
+void GradeRunner::runLockstep(vector<Case*>& group) {
+    size_t count = group.size();
+    vector<QueueInputChannel> inputs(count);
+    vector<vector<string>> printed(count);
+    vector<ostringstream> errors(count);
+    vector<LockstepInterpreter::Lane> lanes(count);
+    for (size_t i = 0; i < count; ++i) {
+        loadInput(inputs[i], group[i]->inputPath);
+        lanes[i].input = &inputs[i];
+        lanes[i].output = collectPrinted(printed[i]);
+        lanes[i].errors = &errors[i];
+    }
+
+    auto start = chrono::steady_clock::now();
+    LockstepInterpreter interpreter;
+    interpreter.setLimits(options.limits);
+    interpreter.run(*program, lanes);
+    double runMs = millisSince(start);
+    for (size_t i = 0; i < count; ++i) {
+        group[i]->runMs = runMs;
+        group[i]->instructions = lanes[i].instructions;
+        judge(*group[i], printed[i], errors[i].str(), lanes[i].exceeded);
+    }
+}
+
+int GradeRunner::run(const shared_ptr<const IRProgram>& compiled, const string& casesDir) {
+    program = compiled;
+    vector<Case> cases;
+    error_code ec;
+    for (fs::directory_iterator it(casesDir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".in") continue;
+        Case testCase;
+        testCase.name = it->path().stem().string();
+        testCase.inputPath = it->path().string();
+        testCase.expectedPath = fs::path(it->path()).replace_extension(".expected").string();
+        cases.push_back(testCase);
+    }
+    if (ec || cases.empty()) {
+        cerr << "No test cases (name.in with name.expected) in " << casesDir << endl;
+        return 1;
+    }
+    sort(cases.begin(), cases.end(), [](const Case& a, const Case& b) { return a.name < b.name; });
+
+    vector<Case*> runnable;
+    for (Case& testCase : cases) {
+        if (fs::exists(testCase.expectedPath, ec)) runnable.push_back(&testCase);
+        else testCase.verdict = "missing-expected";
+    }
+
+    bool lockstepRun = lockstep && LockstepInterpreter::supports(*program);
+    if (lockstep && !lockstepRun)
+        cerr << "Program calls functions; running the cases one by one" << endl;
+
+    auto start = chrono::steady_clock::now();
+    ThreadPool pool(workers);
+    vector<vector<Case*>> groups;
+    if (lockstepRun) {
+        // One group per worker, as wide as the lanes allow
+        size_t width = (runnable.size() + pool.size() - 1) / pool.size();
+        width = min<size_t>(max<size_t>(width, 1), LockstepInterpreter::kMaxLanes);
+        for (size_t i = 0; i < runnable.size(); i += width)
+            groups.emplace_back(runnable.begin() + i, runnable.begin() + min(i + width, runnable.size()));
+        for (vector<Case*>& group : groups) pool.submit([this, &group] { runLockstep(group); });
+    } else {
+        for (Case* testCase : runnable) pool.submit([this, testCase] { runCase(*testCase); });
+    }
+    pool.wait();
+    double wallMs = millisSince(start);
+
+    size_t passed = 0;
+    for (const Case& testCase : cases) {
+        printf("%-16s %12llu instr %9.2f ms  %s", testCase.verdict.c_str(), testCase.instructions,
+               testCase.runMs, testCase.name.c_str());
+        if (!testCase.detail.empty()) printf("  (%s)", testCase.detail.c_str());
+        printf("\n");
+        if (testCase.verdict == "pass") passed++;
+    }
+    printf("%zu/%zu cases passed; %.1f ms wall, %u workers%s\n", passed, cases.size(), wallMs,
+           pool.size(), lockstepRun ? ", lockstep" : "");
+    return passed == cases.size() ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "input_channel.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+bool StdinInputChannel::readLine(string& line) {
+    while (getline(cin, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) return true;
+    }
+    return false;
+}
+
+FileInputChannel::FileInputChannel(const string& path) : path(path) {
+#ifdef __linux__
+    // Watch the directory so the file may be created or replaced freely
+    size_t slash = path.find_last_of('/');
+    string dir = slash == string::npos ? "." : path.substr(0, slash);
+    inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (inotifyFd >= 0 &&
+        inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO) < 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+}
+
+FileInputChannel::~FileInputChannel() {
+#ifdef __linux__
+    if (inotifyFd >= 0) close(inotifyFd);
+#endif
+}
+
+bool FileInputChannel::readLine(string& line) {
+    while (!takeLine(line)) waitForChange();
+    return true;
+}
+
+bool FileInputChannel::takeLine(string& line) {
+    ifstream in(path);
+    if (!in || !getline(in, line) || line.empty()) return false;
+    if (line.back() == '\r') line.pop_back();
+    in.close();
+    ofstream clear(path, ios::trunc);
+    return true;
+}
+
+void FileInputChannel::waitForChange() {
+#ifdef __linux__
+    if (inotifyFd >= 0) {
+        // The timeout only guards against a missed event
+        pollfd pfd{inotifyFd, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) > 0) {
+            char events[4096];
+            ssize_t drained = read(inotifyFd, events, sizeof(events));
+            (void)drained;  // the file is re-read whatever the events were
+        }
+        return;
+    }
+#endif
+    this_thread::sleep_for(chrono::milliseconds(100));
+}
+
+bool QueueInputChannel::readLine(string& line) {
+    unique_lock<mutex> lock(queueMutex);
+    ready.wait(lock, [this] { return closed || !lines.empty(); });
+    if (lines.empty()) return false;
+    line = move(lines.front());
+    lines.pop_front();
+    return true;
+}
+
+InputChannel::Poll QueueInputChannel::tryReadLine(string& line) {
+    lock_guard<mutex> lock(queueMutex);
+    if (lines.empty()) return closed ? Poll::Closed : Poll::Empty;
+    line = move(lines.front());
+    lines.pop_front();
+    return Poll::Ready;
+}
+
+bool QueueInputChannel::hasInput() {
+    lock_guard<mutex> lock(queueMutex);
+    return closed || !lines.empty();
+}
+
+void QueueInputChannel::push(const string& line) {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        lines.push_back(line);
+    }
+    ready.notify_one();
+}
+
+void QueueInputChannel::close() {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        closed = true;
+    }
+    ready.notify_all();
+}
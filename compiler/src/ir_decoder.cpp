@@ -0,0 +1,348 @@
+#include "ir_decoder.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+using namespace std;
+
+shared_ptr<IRProgram> IRDecoder::decode(const IRModule& module) {
+    preprocess(module.lines);
+    decodeLines(module.lines);
+    fuse();
+    analyzePurity();
+
+    IRProgram::Tables tables;
+    tables.code = move(program);
+    tables.callArgs = move(callArgs);
+    for (const FunctionState& fn : functions) {
+        FunctionRecord record;
+        record.entry = fn.entry;
+        record.exit = fn.exit;
+        record.arity = fn.arity;
+        record.frameSize = fn.slotNames.size();
+        record.name = internString(fn.name);
+        record.slotNames = tables.slotNames.size();
+        record.pure = fn.pure;
+        for (const string& slot : fn.slotNames) tables.slotNames.push_back(internString(slot));
+        tables.functions.push_back(record);
+    }
+    for (const auto& label : labelMap) {
+        LabelRecord record;
+        record.name = internString(label.first);
+        record.target = label.second;
+        tables.labels.push_back(record);
+    }
+    sort(tables.labels.begin(), tables.labels.end(),
+         [](const LabelRecord& x, const LabelRecord& y) { return x.target < y.target; });
+    tables.strings = move(strings);
+    return IRProgram::fromTables(move(tables));
+}
+
+// Labels do not become instructions; they resolve to the index of the
+// instruction that follows them.
+void IRDecoder::preprocess(const vector<IRLine>& lines) {
+    functions.assign(1, FunctionState());
+    lineToInstruction.assign(lines.size(), -1);
+    int count = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        const IRLine& line = lines[i];
+        if (line.kind == IRLine::Label) {
+            labelMap[line.name] = count;
+            continue;
+        }
+        if (line.kind == IRLine::Function) {
+            FunctionState info;
+            info.name = line.name;
+            info.entry = count + 1;
+            functionMap[info.name] = functions.size();
+            functions.push_back(info);
+        }
+        if (line.kind == IRLine::Param) {
+            decodingFunction = functions.size() - 1;
+            internSlot(line.name);
+            functions.back().arity = functions.back().slotNames.size();
+            continue;
+        }
+        lineToInstruction[i] = count++;
+    }
+}
+
+void IRDecoder::decodeLines(const vector<IRLine>& lines) {
+    program.clear();
+    decodingFunction = 0;
+    int nextFunction = 1;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lineToInstruction[i] < 0) continue;
+        program.push_back(decodeLine(lines[i]));
+        if (program.back().op == OpCode::FunctionEntry) decodingFunction = nextFunction++;
+        else if (program.back().op == OpCode::EndFunction) decodingFunction = 0;
+    }
+    Instruction halt;
+    halt.op = OpCode::Halt;
+    program.push_back(halt);
+
+    // Falling into a FUNCTION header from the surrounding code skips its body
+    int exit = program.size() - 1;
+    for (int i = (int)program.size() - 1, f = nextFunction - 1; i >= 0; --i) {
+        if (program[i].op == OpCode::EndFunction) {
+            exit = i;
+        } else if (program[i].op == OpCode::FunctionEntry) {
+            program[i].target = exit + 1;
+            functions[f--].exit = exit;
+        }
+    }
+}
+
+// Load-time superinstructions. The generator lowers every condition into a
+// temp followed by IF NOT, every assignment from an expression into a temp
+// followed by a copy, and RETURN f(...) into a call followed by RETURN of
+// its temp; when the temp has no other reader the pair is merged into one
+// instruction and the program is compacted.
+void IRDecoder::fuse() {
+    static const unordered_map<OpCode, OpCode> branchOps = {
+        {OpCode::Eq, OpCode::IfNotEq}, {OpCode::Ne, OpCode::IfNotNe},
+        {OpCode::Lt, OpCode::IfNotLt}, {OpCode::Le, OpCode::IfNotLe},
+        {OpCode::Gt, OpCode::IfNotGt}, {OpCode::Ge, OpCode::IfNotGe}
+    };
+    auto writesResult = [](OpCode op) {
+        return op == OpCode::Copy || op == OpCode::Call ||
+               (op >= OpCode::Add && op <= OpCode::Ge);
+    };
+    auto isJump = [](OpCode op) {
+        return op == OpCode::Goto || op == OpCode::IfNotGoto || op == OpCode::FunctionEntry ||
+               (op >= OpCode::IfNotEq && op <= OpCode::IfNotGe);
+    };
+
+    int n = program.size();
+    vector<int> owner(n, 0);
+    vector<vector<int>> reads(functions.size());
+    for (size_t f = 0; f < functions.size(); ++f)
+        reads[f].assign(functions[f].slotNames.size(), 0);
+
+    int current = 0, nextFunction = 1;
+    for (int i = 0; i < n; ++i) {
+        const Instruction& instr = program[i];
+        if (instr.op == OpCode::FunctionEntry) {
+            current = nextFunction++;
+            continue;
+        }
+        owner[i] = current;
+        if (instr.a.kind == Operand::Variable) reads[current][instr.a.value]++;
+        if (instr.b.kind == Operand::Variable) reads[current][instr.b.value]++;
+        for (int k = 0; k < instr.argCount; ++k) {
+            const Operand& arg = callArgs[instr.argBegin + k];
+            if (arg.kind == Operand::Variable) reads[current][arg.value]++;
+        }
+        if (instr.op == OpCode::EndFunction) current = 0;
+    }
+
+    vector<char> isTarget(n + 1, 0);
+    for (const Instruction& instr : program)
+        if (isJump(instr.op) && instr.target >= 0) isTarget[instr.target] = 1;
+    for (const FunctionState& fn : functions) isTarget[fn.entry] = 1;
+
+    vector<Instruction> fused;
+    vector<int> newIndex(n + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        newIndex[i] = fused.size();
+        Instruction instr = program[i];
+
+        if (i + 1 < n && !isTarget[i + 1] && writesResult(instr.op) &&
+            reads[owner[i]][instr.dst] == 1) {
+            const Instruction& next = program[i + 1];
+            bool readsTemp = next.a.kind == Operand::Variable && next.a.value == instr.dst;
+
+            if (readsTemp && next.op == OpCode::IfNotGoto && next.target >= 0 &&
+                branchOps.count(instr.op)) {
+                instr.op = branchOps.at(instr.op);
+                instr.dst = -1;
+                instr.target = next.target;
+                newIndex[++i] = fused.size();
+            } else if (readsTemp && next.op == OpCode::Copy) {
+                instr.dst = next.dst;
+                newIndex[++i] = fused.size();
+            } else if (readsTemp && next.op == OpCode::Return && instr.op == OpCode::Call &&
+                       instr.target >= 0 && owner[i] != 0) {
+                // RETURN f(...): the callee can take over the current frame
+                instr.op = OpCode::TailCall;
+                instr.dst = -1;
+                newIndex[++i] = fused.size();
+            }
+        }
+        fused.push_back(instr);
+    }
+    newIndex[n] = fused.size();
+
+    for (Instruction& instr : fused)
+        if (isJump(instr.op) && instr.target >= 0) instr.target = newIndex[instr.target];
+    for (FunctionState& fn : functions) {
+        fn.entry = newIndex[fn.entry];
+        fn.exit = newIndex[fn.exit];
+    }
+    for (auto& label : labelMap) label.second = newIndex[label.second];
+    program = move(fused);
+}
+
+// A function is pure when its body has no observable effect besides its
+// result: frames are private, so only output, input and calls to impure
+// functions can disqualify it. Iterated to a fixed point for call chains.
+void IRDecoder::analyzePurity() {
+    for (size_t f = 1; f < functions.size(); ++f) functions[f].pure = true;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t f = 1; f < functions.size(); ++f) {
+            FunctionState& fn = functions[f];
+            if (!fn.pure) continue;
+            for (int i = fn.entry; i < fn.exit && fn.pure; ++i) {
+                switch (program[i].op) {
+                case OpCode::Print: case OpCode::PrintString: case OpCode::Read:
+                case OpCode::Access: case OpCode::Unknown:
+                    fn.pure = false;
+                    break;
+                case OpCode::Call: case OpCode::TailCall:
+                    fn.pure = program[i].target >= 0 && functions[program[i].target].pure;
+                    break;
+                default:
+                    break;
+                }
+            }
+            if (!fn.pure) changed = true;
+        }
+    }
+}
+
+int IRDecoder::internSlot(const string& name) {
+    FunctionState& fn = functions[decodingFunction];
+    auto it = fn.slotIndex.find(name);
+    if (it != fn.slotIndex.end()) return it->second;
+    fn.slotNames.push_back(name);
+    return fn.slotIndex[name] = fn.slotNames.size() - 1;
+}
+
+int IRDecoder::internString(const string& text) {
+    auto it = stringIndex.find(text);
+    if (it != stringIndex.end()) return it->second;
+    strings.push_back(text);
+    return stringIndex[text] = strings.size() - 1;
+}
+
+Operand IRDecoder::decodeOperand(const string& token) {
+    Operand operand;
+    if (isdigit(token[0]) || (token[0] == '-' && token.size() > 1)) {
+        operand.value = strtol(token.c_str(), nullptr, 10);
+    } else if (token == "TRUE" || token == "FALSE") {
+        operand.value = token == "TRUE" ? 1 : 0;
+    } else {
+        operand.kind = Operand::Variable;
+        operand.value = internSlot(token);
+    }
+    return operand;
+}
+
+namespace {
+bool isName(const string& token) {
+    if (token.empty()) return false;
+    for (unsigned char c : token)
+        if (!isalnum(c) && c != '_') return false;
+    return true;
+}
+
+// A variable, an integer or TRUE/FALSE; string literals and anything else
+// the generator could not lower are not
+bool isOperand(const string& token) {
+    return isName(token[0] == '-' ? token.substr(1) : token);
+}
+}
+
+// A line whose parts are not what its kind expects decodes as Unknown,
+// which reports it when run
+Instruction IRDecoder::decodeLine(const IRLine& line) {
+    static const unordered_map<string, OpCode> binaryOps = {
+        {"+", OpCode::Add}, {"-", OpCode::Sub}, {"*", OpCode::Mul},
+        {"/", OpCode::Div}, {"%", OpCode::Mod},
+        {"==", OpCode::Eq}, {"!=", OpCode::Ne}, {"<", OpCode::Lt},
+        {"<=", OpCode::Le}, {">", OpCode::Gt}, {">=", OpCode::Ge}
+    };
+
+    Instruction instr;
+    switch (line.kind) {
+    case IRLine::Function:
+        instr.op = OpCode::FunctionEntry;
+        return instr;
+    case IRLine::EndFunction:
+        instr.op = OpCode::EndFunction;
+        return instr;
+    case IRLine::Binary:
+        if (!isName(line.dst) || !isOperand(line.a) || !isOperand(line.b) ||
+            !binaryOps.count(line.op))
+            break;
+        instr.op = binaryOps.at(line.op);
+        instr.dst = internSlot(line.dst);
+        instr.a = decodeOperand(line.a);
+        instr.b = decodeOperand(line.b);
+        return instr;
+    case IRLine::Copy:
+        if (!isName(line.dst) || !isOperand(line.a)) break;
+        instr.op = OpCode::Copy;
+        instr.dst = internSlot(line.dst);
+        instr.a = decodeOperand(line.a);
+        return instr;
+    case IRLine::Print:
+        if (line.a.empty()) break;
+        if (line.a.front() == '"' && line.a.back() == '"') {
+            instr.op = OpCode::PrintString;
+            instr.text = internString(line.a.substr(1, line.a.length() - 2));
+        } else {
+            instr.op = OpCode::Print;
+            instr.a = decodeOperand(line.a);
+            instr.text = internString(line.a);
+        }
+        return instr;
+    case IRLine::Read:
+        if (!isName(line.dst)) break;
+        instr.op = OpCode::Read;
+        instr.dst = internSlot(line.dst);
+        return instr;
+    case IRLine::IfNot:
+        if (!isOperand(line.a) || !isName(line.name)) break;
+        instr.op = OpCode::IfNotGoto;
+        instr.a = decodeOperand(line.a);
+        instr.target = labelMap.count(line.name) ? labelMap[line.name] : -1;
+        instr.text = internString(line.name);
+        return instr;
+    case IRLine::Goto:
+        if (!isName(line.name)) break;
+        instr.op = OpCode::Goto;
+        instr.target = labelMap.count(line.name) ? labelMap[line.name] : -1;
+        instr.text = internString(line.name);
+        return instr;
+    case IRLine::Return:
+        if (!isOperand(line.a)) break;
+        instr.op = OpCode::Return;
+        instr.a = decodeOperand(line.a);
+        return instr;
+    case IRLine::Call:
+        if (!isName(line.dst) || !isName(line.name)) break;
+        instr.op = OpCode::Call;
+        instr.dst = internSlot(line.dst);
+        instr.target = functionMap.count(line.name) ? functionMap[line.name] : -1;
+        instr.text = internString(line.name);
+        instr.argBegin = callArgs.size();
+        for (const string& arg : line.args)
+            if (!arg.empty()) callArgs.push_back(decodeOperand(arg));
+        instr.argCount = callArgs.size() - instr.argBegin;
+        return instr;
+    case IRLine::Access:
+        if (!isName(line.name) || !isOperand(line.a)) break;
+        instr.op = OpCode::Access;
+        instr.a = decodeOperand(line.a);
+        instr.text = internString(line.name);
+        return instr;
+    case IRLine::Label: case IRLine::Param: case IRLine::Raw:
+        break;
+    }
+    instr.op = OpCode::Unknown;
+    instr.text = internString(line.toString());
+    return instr;
+}
@@ -1,25 +1,18 @@
 #include "ir_generator.h"
 #include <iostream>
 
-IRGenerator::IRGenerator(const std::string& outputPath) {
-    outFile.open(outputPath);
-    if (!outFile) {
-        std::cerr << "Error: Could not open IR output file!\n";
-        exit(1);
-    }
-}
-
-void IRGenerator::generate(ASTNode* root) {
+IRModule IRGenerator::generate(ASTNode* root) {
+    module = IRModule();
     for (auto& child : root->children) {
         generateStatement(child.get());
     }
-    outFile.close();
+    return std::move(module);
 }
 
 void IRGenerator::generateStatement(ASTNode* node) {
     if (node->type == "Assignment") {
         std::string rhs = generateExpression(node->children[1].get());
-        outFile << node->children[0]->value << " = " << rhs << "\n";
+        emit(IRLine::copy(node->children[0]->value, rhs));
 
     } else if (node->type == "PrintStatement") {
         std::string value = generateExpression(node->children[0].get());
@@ -27,18 +20,18 @@ void IRGenerator::generateStatement(ASTNode* node) {
         // [Change 1] Handle string literals for PRINT
         if (node->children[0]->type == "StringLiteral") {
             // If it's a string literal, print it with quotes
-            outFile << "PRINT " << "\"" << value << "\"" << "\n";  // Ensure quotes are included
+            emit(IRLine::print("\"" + value + "\""));  // Ensure quotes are included
         } else {
             // If it's not a string literal, print the computed expression or variable
-            outFile << "PRINT " << value << "\n";
+            emit(IRLine::print(value));
         }
         
     }  else if (node->type == "InputStatement") {
-        outFile << "READ " << node->value << "\n";
+        emit(IRLine::read(node->value));
 
     } else if (node->type == "ReturnStatement") {
         std::string value = generateExpression(node->children[0].get());
-        outFile << "RETURN " << value << "\n";
+        emit(IRLine::ret(value));
 
     } else if (node->type == "IfStatement") {
         handleIfElseIf(node);
@@ -46,41 +39,38 @@ void IRGenerator::generateStatement(ASTNode* node) {
     } else if (node->type == "LoopStatement") {
         std::string loopStart = "L" + std::to_string(tempVarCount++);
         std::string loopEnd = "L" + std::to_string(tempVarCount++);
-        outFile << loopStart << ":\n";
+        emit(IRLine::label(loopStart));
         std::string cond = generateExpression(node->children[0].get());
-        outFile << "IF NOT " << cond << " GOTO " << loopEnd << "\n";
+        emit(IRLine::ifNot(cond, loopEnd));
         for (size_t i = 1; i < node->children.size(); ++i) {
             generateStatement(node->children[i].get());
         }
-        outFile << "GOTO " << loopStart << "\n";
-        outFile << loopEnd << ":\n";
+        emit(IRLine::jump(loopStart));
+        emit(IRLine::label(loopEnd));
 
     } else if (node->type == "FunctionDeclaration") {
-        outFile << "FUNCTION " << node->value << ":\n";
+        emit(IRLine::function(node->value));
         for (auto& stmt : node->children) {
             generateStatement(stmt.get());
         }
-        outFile << "END FUNCTION\n";
+        emit(IRLine::endFunction());
+
+    } else if (node->type == "Parameter") {
+        emit(IRLine::param(node->value));
 
     } else if (node->type == "FunctionCall") {
-        std::string args;
-        for (auto& arg : node->children) {
-            args += generateExpression(arg.get()) + ", ";
-        }
-        if (!args.empty()) args.pop_back(), args.pop_back(); // remove trailing comma
-        std::string temp = newTemp();
-        outFile << temp << " = CALL " << node->value << "(" << args << ")\n";
+        generateCall(node);
 
     } else if (node->type == "StructDeclaration") {
-        outFile << "STRUCT " << node->value << "\n";
+        emit(IRLine::raw("STRUCT " + node->value));
         for (auto& field : node->children) {
-            outFile << "  FIELD " << field->value << "\n";
+            emit(IRLine::raw("  FIELD " + field->value));
         }
-        outFile << "END STRUCT\n";
+        emit(IRLine::raw("END STRUCT"));
 
     } else if (node->type == "ArrayAccess") {
         std::string index = generateExpression(node->children[0].get());
-        outFile << "ACCESS " << node->value << "[" << index << "]\n";
+        emit(IRLine::access(node->value, index));
     }
 }
 
@@ -97,13 +87,13 @@ void IRGenerator::handleIfElseIf(ASTNode* node) {
             // First child = condition (RelationalOperator), rest = body
             ASTNode* conditionNode = child->children[0].get();
             std::string cond = generateExpression(conditionNode);
-            outFile << "IF NOT " << cond << " GOTO " << labelNextCond << "\n";
+            emit(IRLine::ifNot(cond, labelNextCond));
 
             for (size_t i = 1; i < child->children.size(); ++i) {
                 generateStatement(child->children[i].get());
             }
-            outFile << "GOTO " << labelEnd << "\n";
-            outFile << labelNextCond << ":\n";
+            emit(IRLine::jump(labelEnd));
+            emit(IRLine::label(labelNextCond));
         }
     }
 
@@ -117,7 +107,7 @@ void IRGenerator::handleIfElseIf(ASTNode* node) {
         }
     }
 
-    outFile << labelEnd << ":\n";
+    emit(IRLine::label(labelEnd));
 }
 
 
@@ -130,21 +120,14 @@ std::string IRGenerator::generateExpression(ASTNode* node) {
         std::string left = generateExpression(node->children[0].get());
         std::string right = generateExpression(node->children[1].get());
         std::string temp = newTemp();
-        outFile << temp << " = " << left << " " << node->value << " " << right << "\n";
+        emit(IRLine::binary(temp, left, node->value, right));
         return temp;
     } else if (node->type == "FunctionCall") {
-        std::string args;
-        for (auto& arg : node->children) {
-            args += generateExpression(arg.get()) + ", ";
-        }
-        if (!args.empty()) args.pop_back(), args.pop_back(); // remove trailing comma
-        std::string temp = newTemp();
-        outFile << temp << " = CALL " << node->value << "(" << args << ")\n";
-        return temp;
+        return generateCall(node);
     } else if (node->type == "ArrayAccess") {
         std::string index = generateExpression(node->children[0].get());
         std::string temp = newTemp();
-        outFile << temp << " = " << node->value << "[" << index << "]\n";
+        emit(IRLine::raw(temp + " = " + node->value + "[" + index + "]"));
         return temp;
     }
 
@@ -152,6 +135,16 @@ std::string IRGenerator::generateExpression(ASTNode* node) {
 }
 
 
+std::string IRGenerator::generateCall(ASTNode* node) {
+    std::vector<std::string> args;
+    for (auto& arg : node->children) {
+        args.push_back(generateExpression(arg.get()));
+    }
+    std::string temp = newTemp();
+    emit(IRLine::call(temp, node->value, std::move(args)));
+    return temp;
+}
+
 std::string IRGenerator::newTemp() {
     return "t" + std::to_string(tempVarCount++);
 }
@@ -1,180 +1,510 @@
 #include "ir_interpreter.h"
+#include "ir_decoder.h"
+#include "metrics.h"
 #include <iostream>
-#include <fstream>
-#include <regex>
-#include <sstream>
 #include <algorithm>
-#include <chrono>
-#include <thread>
+#include <cstdlib>
 using namespace std;
 
-vector<string> IRInterpreter::readIR(const string& path) {
-    ifstream file(path);
-    vector<string> lines;
-    string line;
-    while (getline(file, line)) {
-        if (!line.empty()) lines.push_back(line);
+IRInterpreter::RunStatus IRInterpreter::interpret(const IRModule& module) {
+    IRDecoder decoder;
+    return run(decoder.decode(module));
+}
+
+IRInterpreter::RunStatus IRInterpreter::run(shared_ptr<const IRProgram> decoded) {
+    program = move(decoded);
+    status = RunStatus::Finished;
+    executed = 0;
+    exceeded = Limit::None;
+    reportedError = false;
+    runTime = {};
+    quickenedCode.clear();
+    if (quickening) {
+        quickenedCode.assign(program->code, program->code + program->codeSize);
+        runCode = quickenedCode.data();
+    } else {
+        runCode = program->code;
+    }
+
+    instructionPointer = 0;
+    awaitingInput = false;
+    threadedCode.clear();
+    try {
+        allocateRun();
+    } catch (const RunArena::Exhausted&) {
+        status = RunStatus::LimitExceeded;
+        exceeded = Limit::Memory;
+        countRunEnd();
+        return status;
     }
-    return lines;
+    return resume();
 }
 
-void emitJSON(const std::string& type, const std::string& key, const std::string& val) {
-    std::cout << "{\"type\":\"" << type << "\",\"" << key << "\":\"" << val << "\"}" << std::endl;
+// A fresh arena holding the stacks and RunMemory; the last run's is freed
+void IRInterpreter::allocateRun() {
+    memory = nullptr;
+    callStack = nullptr;
+    slotStack = nullptr;
+    arena = make_unique<RunArena>(limits.memoryBytes);
+
+    maxFrames = kMaxFrames;
+    stackSlots = kStackSlots;
+    if (limits.memoryBytes) {
+        maxFrames = static_cast<int>(min<unsigned long long>(kMaxFrames, limits.memoryBytes / 4 / sizeof(Frame)));
+        stackSlots = static_cast<int>(min<unsigned long long>(kStackSlots, limits.memoryBytes / 4 / sizeof(int)));
+    }
+    stacksCut = maxFrames < kMaxFrames || stackSlots < kStackSlots;
+    int mainSlots = program->functions[0].frameSize;
+    if (maxFrames < 1 || stackSlots < mainSlots) throw RunArena::Exhausted();
+
+    // Left uninitialised: pages are only touched as frames are pushed
+    callStack = static_cast<Frame*>(arena->allocate(sizeof(Frame) * maxFrames, alignof(Frame)));
+    slotStack = static_cast<int*>(arena->allocate(sizeof(int) * stackSlots, alignof(int)));
+    memory = new (arena->allocate(sizeof(RunMemory), alignof(RunMemory))) RunMemory(arena.get());
+    memoFull = false;
+
+    callDepth = 0;
+    callStack[0] = Frame{0, 0, -1, -1, -1};
+    slots = slotStack;
+    fill(slots, slots + mainSlots, 0);
 }
 
-void IRInterpreter::interpret(const string& path) {
-    irCode = readIR(path);
-    preprocess(irCode);
-    callStack.push(Frame());  // main frame
-    execute();
+IRInterpreter::RunStatus IRInterpreter::resume() {
+    status = RunStatus::Finished;
+    unsigned long long executedBefore = executed;
+    size_t writtenBefore = output.bytesWritten();
+    sliceStart = chrono::steady_clock::now();
+    try {
+        execute();
+    } catch (const RunArena::Exhausted&) {
+        executed += dispatched;  // the loop was left without VM_EXIT
+        status = RunStatus::LimitExceeded;
+        exceeded = Limit::Memory;
+    }
+    runTime += chrono::steady_clock::now() - sliceStart;
+    // Limits are checked every kCheckInterval taken jumps, so a run can go
+    // over one and finish before the next check
+    if (status == RunStatus::Finished) {
+        if (limits.instructions && executed > limits.instructions) exceeded = Limit::Instructions;
+        else if (limits.milliseconds && runTime >= chrono::milliseconds(limits.milliseconds))
+            exceeded = Limit::Time;
+        if (exceeded != Limit::None) status = RunStatus::LimitExceeded;
+    }
+    output.flush();
+
+    Metrics& metrics = Metrics::global();
+    metrics.instructions.add(executed - executedBefore);
+    metrics.outputBytes.add(output.bytesWritten() - writtenBefore);
+    if (status != RunStatus::WaitingForInput && status != RunStatus::Preempted) countRunEnd();
+    return status;
 }
 
-void IRInterpreter::preprocess(const vector<string>& lines) {
-    for (int i = 0; i < lines.size(); ++i) {
-        smatch m;
-        if (regex_match(lines[i], m, regex(R"(^(\w+):$)")))
-            labelMap[m[1]] = i;
-        else if (regex_match(lines[i], m, regex(R"(FUNCTION\s+(\w+):)")))
-            functionMap[m[1]] = i + 1;
+// Once per run, when it is over
+void IRInterpreter::countRunEnd() {
+    Metrics& metrics = Metrics::global();
+    if (status == RunStatus::LimitExceeded) {
+        metrics.runs[Metrics::LimitExceeded].add();
+        metrics.limitsExceeded[static_cast<int>(exceeded)].add();
+    } else {
+        metrics.runs[status == RunStatus::Cancelled ? Metrics::Cancelled : Metrics::Finished].add();
     }
+    metrics.runTime.record(chrono::duration_cast<chrono::nanoseconds>(runTime).count());
 }
 
-void IRInterpreter::execute() {
-    while (instructionPointer < irCode.size()) {
-        executeLine(irCode[instructionPointer]);
-        instructionPointer++;
+void IRInterpreter::setLimits(const Limits& budget) {
+    limits = budget;
+    limited = limits.instructions || limits.milliseconds;
+    outputCap = limits.outputBytes ? limits.outputBytes : ~0ull;
+}
+
+const char* IRInterpreter::limitName(Limit limit) {
+    switch (limit) {
+    case Limit::Instructions: return "instructions";
+    case Limit::Time: return "time";
+    case Limit::OutputBytes: return "output";
+    case Limit::Memory: return "memory";
+    default: return "none";
     }
 }
 
-int IRInterpreter::evaluateOperand(const string& token) {
-    if (isdigit(token[0]) || (token[0] == '-' && token.size() > 1))
-        return stoi(token);
-    if (callStack.top().variables.count(token))
-        return callStack.top().variables[token];
-    return 0;
+static int applyBinary(OpCode op, int a, int b) {
+    switch (op) {
+    case OpCode::Add: return a + b;
+    case OpCode::Sub: return a - b;
+    case OpCode::Mul: return a * b;
+    case OpCode::Div: return divideInt(a, b);
+    case OpCode::Mod: return remainderInt(a, b);
+    case OpCode::Eq: case OpCode::IfNotEq: return a == b;
+    case OpCode::Ne: case OpCode::IfNotNe: return a != b;
+    case OpCode::Lt: case OpCode::IfNotLt: return a < b;
+    case OpCode::Le: case OpCode::IfNotLe: return a <= b;
+    case OpCode::Gt: case OpCode::IfNotGt: return a > b;
+    case OpCode::Ge: case OpCode::IfNotGe: return a >= b;
+    default: return 0;
+    }
 }
 
-void IRInterpreter::jumpToLabel(const string& label) {
-    if (labelMap.count(label))
-        instructionPointer = labelMap[label] - 1;
-    else
-        cerr << "[ERROR] Label not found: " << label << endl;
-}
-
-void IRInterpreter::executeLine(const string& line) {
-    smatch m;
-
-    if (regex_match(line, regex(R"(^\w+:$)"))) return;
-    if (regex_match(line, regex(R"(^FUNCTION\s+\w+:$)"))) return;
-
-    if (regex_match(line, m, regex(R"(^(\w+)\s*=\s*(\w+|\d+)\s*(==|!=|>=|<=|>|<)\s*(\w+|\d+)$)"))) {
-        int a = evaluateOperand(m[2]);
-        int b = evaluateOperand(m[4]);
-        string op = m[3];
-        bool result = false;
-
-        if (op == "==") result = (a == b);
-        else if (op == "!=") result = (a != b);
-        else if (op == ">")  result = (a > b);
-        else if (op == "<")  result = (a < b);
-        else if (op == ">=") result = (a >= b);
-        else if (op == "<=") result = (a <= b);
-
-        callStack.top().variables[m[1]] = result ? 1 : 0;
-    }
-    else if (regex_match(line, m, regex(R"(^(\w+)\s*=\s*(\w+|\d+)\s*([\+\-\*/%])\s*(\w+|\d+)$)"))) {
-        int a = evaluateOperand(m[2]);
-        int b = evaluateOperand(m[4]);
-        string op = m[3];
-        if (op == "+") callStack.top().variables[m[1]] = a + b;
-        else if (op == "-") callStack.top().variables[m[1]] = a - b;
-        else if (op == "*") callStack.top().variables[m[1]] = a * b;
-        else if (op == "/") callStack.top().variables[m[1]] = b != 0 ? a / b : 0;
-        else if (op == "%") callStack.top().variables[m[1]] = b != 0 ? a % b : 0;
-    }
-    else if (regex_match(line, m, regex(R"(^(\w+)\s*=\s*(\w+|\d+)$)"))) {
-        callStack.top().variables[m[1]] = evaluateOperand(m[2]);
-    }
-    else if (regex_match(line, m, regex(R"(^PRINT\s+(.+)$)"))) {
-        string arg = m[1];
-        if (arg.front() == '"' && arg.back() == '"') {
-            emitJSON("output", "message", arg.substr(1, arg.length() - 2));
+// Rewrites a generic instruction into the form specialised for its operand
+// kinds; runs once per instruction, the first time it executes. Immediate
+// operands on the left are swapped to the right where the operator allows
+// it, and two immediates fold into a constant copy or an unconditional jump.
+void IRInterpreter::quicken(Instruction& instr) {
+    static const unordered_map<OpCode, pair<OpCode, OpCode>> quickForms = {
+        {OpCode::Add, {OpCode::AddVV, OpCode::AddVI}}, {OpCode::Sub, {OpCode::SubVV, OpCode::SubVI}},
+        {OpCode::Mul, {OpCode::MulVV, OpCode::MulVI}}, {OpCode::Div, {OpCode::DivVV, OpCode::DivVI}},
+        {OpCode::Mod, {OpCode::ModVV, OpCode::ModVI}},
+        {OpCode::Eq, {OpCode::EqVV, OpCode::EqVI}}, {OpCode::Ne, {OpCode::NeVV, OpCode::NeVI}},
+        {OpCode::Lt, {OpCode::LtVV, OpCode::LtVI}}, {OpCode::Le, {OpCode::LeVV, OpCode::LeVI}},
+        {OpCode::Gt, {OpCode::GtVV, OpCode::GtVI}}, {OpCode::Ge, {OpCode::GeVV, OpCode::GeVI}},
+        {OpCode::IfNotEq, {OpCode::IfNotEqVV, OpCode::IfNotEqVI}},
+        {OpCode::IfNotNe, {OpCode::IfNotNeVV, OpCode::IfNotNeVI}},
+        {OpCode::IfNotLt, {OpCode::IfNotLtVV, OpCode::IfNotLtVI}},
+        {OpCode::IfNotLe, {OpCode::IfNotLeVV, OpCode::IfNotLeVI}},
+        {OpCode::IfNotGt, {OpCode::IfNotGtVV, OpCode::IfNotGtVI}},
+        {OpCode::IfNotGe, {OpCode::IfNotGeVV, OpCode::IfNotGeVI}}
+    };
+    static const unordered_map<OpCode, OpCode> swappedForms = {
+        {OpCode::Add, OpCode::Add}, {OpCode::Mul, OpCode::Mul},
+        {OpCode::Eq, OpCode::Eq}, {OpCode::Ne, OpCode::Ne},
+        {OpCode::Lt, OpCode::Gt}, {OpCode::Le, OpCode::Ge},
+        {OpCode::Gt, OpCode::Lt}, {OpCode::Ge, OpCode::Le},
+        {OpCode::IfNotEq, OpCode::IfNotEq}, {OpCode::IfNotNe, OpCode::IfNotNe},
+        {OpCode::IfNotLt, OpCode::IfNotGt}, {OpCode::IfNotLe, OpCode::IfNotGe},
+        {OpCode::IfNotGt, OpCode::IfNotLt}, {OpCode::IfNotGe, OpCode::IfNotLe}
+    };
+
+    instr.quickened = 1;
+    bool aVar = instr.a.kind == Operand::Variable;
+    bool bVar = instr.b.kind == Operand::Variable;
+    bool branch = instr.op >= OpCode::IfNotEq && instr.op <= OpCode::IfNotGe;
+
+    if (instr.op == OpCode::Copy) {
+        instr.op = aVar ? OpCode::CopyV : OpCode::CopyI;
+        return;
+    }
+    if (!quickForms.count(instr.op)) return;
+
+    if (!aVar && !bVar) {
+        int value = applyBinary(instr.op, instr.a.value, instr.b.value);
+        if (branch) {
+            instr.op = value ? OpCode::Nop : OpCode::Goto;
         } else {
-            int val = evaluateOperand(arg);
-            emitJSON("output", "message", arg + " = " + to_string(val));
+            instr.op = OpCode::CopyI;
+            instr.a.value = value;
         }
+        return;
+    }
+    if (!aVar) {
+        auto swapped = swappedForms.find(instr.op);
+        if (swapped == swappedForms.end()) return;  // e.g. 1 - x stays generic
+        swap(instr.a, instr.b);
+        instr.op = swapped->second;
+    }
+    if (!bVar && (instr.op == OpCode::Div || instr.op == OpCode::Mod)) {
+        if (instr.b.value == 0 || (instr.b.value == -1 && instr.op == OpCode::Mod)) {
+            instr.op = OpCode::CopyI;  // always 0
+            instr.a.value = 0;
+            return;
+        }
+        if (instr.b.value == -1) return;  // x / -1 may wrap; stays generic
+    }
+    const auto& forms = quickForms.at(instr.op);
+    instr.op = instr.b.kind == Operand::Variable ? forms.first : forms.second;
+}
+
+int IRInterpreter::evaluateOperand(const Operand& operand) {
+    return operand.kind == Operand::Immediate ? operand.value : slots[operand.value];
+}
+
+// `count` is what the current slice has dispatched so far
+bool IRInterpreter::overLimit(unsigned long long count) {
+    if (limits.instructions && executed + count >= limits.instructions)
+        exceeded = Limit::Instructions;
+    else if (limits.milliseconds &&
+             runTime + (chrono::steady_clock::now() - sliceStart) >=
+                 chrono::milliseconds(limits.milliseconds))
+        exceeded = Limit::Time;
+    else
+        return false;
+    status = RunStatus::LimitExceeded;
+    return true;
+}
+
+ostream& IRInterpreter::reportError() {
+    output.flush();
+    reportedError = true;
+    return *errors;
+}
+
+bool IRInterpreter::stopRequested() {
+    if (cancelFlag && cancelFlag->load(memory_order_relaxed)) status = RunStatus::Cancelled;
+    return status != RunStatus::Finished;
+}
+
+IRInterpreter::ReadResult IRInterpreter::readInput(int slot, int& value) {
+    string varName(program->slotName(callStack[callDepth].function, slot));
+    if (!awaitingInput) {
+        output.event("input", "prompt", "Enter value for " + varName + ":");
+        output.flush();
     }
-    else if (regex_match(line, m, regex(R"(^READ\s+(\w+)$)"))) {
-    string varName = m[1];
-    emitJSON("input", "prompt", "Enter value for " + varName + ":");
 
     string inputVal;
-    while (true) {
-        ifstream in("../../tests/input_queue.txt");
-        if (in) {
-            getline(in, inputVal);
-            if (!inputVal.empty()) break;
-        }
-        this_thread::sleep_for(chrono::milliseconds(100));
-    }
-    // Clear file
-    ofstream clear("../../tests/input_queue.txt", ios::trunc);
-    callStack.top().variables[varName] = stoi(inputVal);
-}
-    else if (regex_match(line, m, regex(R"(^IF\s+NOT\s+(\w+)\s+GOTO\s+(\w+)$)"))) {
-        int cond = evaluateOperand(m[1]);
-        if (!cond) jumpToLabel(m[2]);
-    }
-    else if (regex_match(line, m, regex(R"(^GOTO\s+(\w+)$)"))) {
-        jumpToLabel(m[1]);
-    }
-    else if (regex_match(line, m, regex(R"(^RETURN\s+(\w+)$)"))) {
-        int value = evaluateOperand(m[1]);
-        string retTarget = callStack.top().returnTarget;
-        callStack.pop();
-        if (!callStack.empty()) {
-            callStack.top().variables[retTarget] = value;
-            emitJSON("output", "message", "Returned: " + to_string(value));
-        }
-        while (instructionPointer < irCode.size() &&
-               !regex_match(irCode[instructionPointer], regex(R"(^END FUNCTION$)")))
-            instructionPointer++;
-    }
-    else if (regex_match(line, m, regex(R"(^(\w+)\s*=\s*CALL\s+(\w+)\((.*)\)$)"))) {
-        string target = m[1], funcName = m[2], argStr = m[3];
-        vector<string> args;
-        istringstream ss(argStr);
-        string tok;
-        while (getline(ss, tok, ',')) {
-            tok.erase(remove_if(tok.begin(), tok.end(), ::isspace), tok.end());
-            if (!tok.empty()) args.push_back(tok);
+    InputChannel::Poll poll = InputChannel::Poll::Closed;
+    if (input) {
+        if (suspendOnRead) poll = input->tryReadLine(inputVal);
+        else poll = input->readLine(inputVal) ? InputChannel::Poll::Ready : InputChannel::Poll::Closed;
+    }
+    if (poll == InputChannel::Poll::Empty && !stopRequested()) {
+        awaitingInput = true;
+        status = RunStatus::WaitingForInput;
+        return ReadResult::Suspended;
+    }
+    awaitingInput = false;
+    if (poll != InputChannel::Poll::Ready) {
+        if (stopRequested()) return ReadResult::Failed;
+        reportError() << "[ERROR] No input available for " << varName << endl;
+        return ReadResult::Failed;
+    }
+    value = strtol(inputVal.c_str(), nullptr, 10);
+    return ReadResult::Read;
+}
+
+bool IRInterpreter::threadedDispatchAvailable() {
+#ifdef PSEUDO_HAVE_COMPUTED_GOTO
+    return true;
+#else
+    return false;
+#endif
+}
+
+void IRInterpreter::execute() {
+    if (dispatchMode == DispatchMode::Threaded && threadedDispatchAvailable())
+        executeThreaded();
+    else
+        executeSwitch();
+}
+
+// Helpers shared by both engines. The hot state (ip, fp) lives in locals and
+// is written back around anything that calls out of the loop.
+#define VM_OPERAND(o) ((o).kind == Operand::Immediate ? (o).value : fp[(o).value])
+#define VM_JUMP(t) { ip = (t); VM_CHARGE(); VM_NEXT(); }
+// Every taken jump, call and return uses up fuel, so any loop, tail calls
+// included, reaches a checkpoint
+#define VM_CHARGE() if (--fuel == 0) VM_CHECKPOINT()
+#define VM_CHECKPOINT() {                                               \
+        fuel = kCheckInterval;                                          \
+        if (stopRequested()) VM_EXIT();                                 \
+        if (limited && overLimit(count)) VM_EXIT();                     \
+        output.flushIfStale();                                          \
+        if (count >= sliceBudget) {                                     \
+            status = RunStatus::Preempted;                              \
+            VM_EXIT();                                                  \
+        }                                                               \
+    }
+// An output event; unlike the other limits, output is checked exactly,
+// before the line that would go over it is written
+#define VM_PRINT(text) {                                                \
+        string message = (text);                                        \
+        if (output.bytesWritten() + message.size() > outputCap) {       \
+            exceeded = Limit::OutputBytes;                              \
+            status = RunStatus::LimitExceeded;                          \
+            VM_EXIT();                                                  \
+        }                                                               \
+        output.event("output", "message", message);                     \
+    }
+#define VM_SAVE() (instructionPointer = ip, dispatched = count)
+#define VM_EXIT() { VM_SAVE(); executed += count; return; }
+// Leaves the loop at the current instruction, which runs again on resume()
+#define VM_SUSPEND() { --ip; --count; VM_EXIT(); }
+#define VM_LOAD() (ip = instructionPointer, fp = slots)
+
+void IRInterpreter::executeSwitch() {
+    const Instruction* code = runCode;
+    const bool quickens = quickening;
+    const Instruction* instr;
+    int ip = instructionPointer;
+    int* fp = slots;
+    int fuel = kCheckInterval;
+    unsigned long long count = 0;   // instructions dispatched
+
+#define VM_CASE(name) case OpCode::name:
+#define VM_NEXT() continue
+#define VM_QUICKEN() { quicken(quickenedCode[--ip]); --count; VM_NEXT(); }
+    for (;;) {
+        instr = &code[ip++];
+        ++count;
+        switch (instr->op) {
+#include "ir_dispatch.inc"
         }
-        callFunction(funcName, args, target);
     }
-    else if (regex_match(line, m, regex(R"(^ACCESS\s+(\w+)\[(\w+)\]$)"))) {
-        string arr = m[1];
-        int idx = evaluateOperand(m[2]);
-        emitJSON("output", "message", arr + "[" + to_string(idx) + "] = " + to_string(arrays[arr][idx]));
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_QUICKEN
+}
+
+// Direct threading: every instruction gets the address of its handler, and
+// each handler jumps straight to the next one without going back through a
+// central switch.
+void IRInterpreter::executeThreaded() {
+#ifdef PSEUDO_HAVE_COMPUTED_GOTO
+#define IR_OPCODE_LABEL(name) &&op_##name,
+    static const void* const labels[] = { IR_OPCODES(IR_OPCODE_LABEL) };
+#undef IR_OPCODE_LABEL
+
+    const Instruction* code = runCode;
+    const bool quickens = quickening;
+    if (threadedCode.empty()) {  // built once per run; resume() keeps it
+        threadedCode.resize(program->codeSize);
+        for (size_t i = 0; i < program->codeSize; ++i)
+            threadedCode[i] = labels[static_cast<int>(code[i].op)];
     }
-    else {
-        cerr << "[WARNING] Unknown instruction: " << line << endl;
+
+    const void** handlers = threadedCode.data();
+    const Instruction* instr;
+    int ip = instructionPointer;
+    int* fp = slots;
+    int fuel = kCheckInterval;
+    unsigned long long count = 0;   // instructions dispatched
+
+#define VM_CASE(name) op_##name:
+#define VM_NEXT() do { ++count; instr = &code[ip]; goto *handlers[ip++]; } while (0)
+#define VM_QUICKEN() {                                                  \
+        quicken(quickenedCode[--ip]);                                   \
+        --count;                                                        \
+        handlers[ip] = labels[static_cast<int>(code[ip].op)];           \
+        VM_NEXT();                                                      \
     }
+    VM_NEXT();
+#include "ir_dispatch.inc"
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_QUICKEN
+#else
+    executeSwitch();
+#endif
 }
 
-void IRInterpreter::callFunction(const string& name, const vector<string>& args, const string& target) {
-    if (!functionMap.count(name)) {
-        cerr << "[ERROR] Function not found: " << name << endl;
+#undef VM_OPERAND
+#undef VM_JUMP
+#undef VM_CHECKPOINT
+#undef VM_CHARGE
+#undef VM_PRINT
+#undef VM_SAVE
+#undef VM_EXIT
+#undef VM_SUSPEND
+#undef VM_LOAD
+
+size_t IRInterpreter::MemoKeyHash::operator()(const pmr::vector<int>& key) const {
+    size_t h = 1469598103934665603ULL;
+    for (int v : key) h = (h ^ static_cast<unsigned>(v)) * 1099511628211ULL;
+    return h;
+}
+
+IRInterpreter::MemoStats IRInterpreter::memoStats() const {
+    MemoStats stats = memoCounters;
+    stats.entries = memory ? memory->memo.size() : 0;
+    return stats;
+}
+
+void IRInterpreter::callFunction(const Instruction& instr) {
+    if (instr.target < 0) {
+        reportError() << "[ERROR] Function not found: " << program->stringAt(instr.text) << endl;
+        return;
+    }
+
+    const Frame& caller = callStack[callDepth];
+    const FunctionRecord& callee = program->functions[instr.target];
+    int bound = min(instr.argCount, callee.arity);
+
+    bool memoise = memoization && callee.pure;
+    if (memoise) {
+        pmr::vector<int>& memoKey = memory->memoKey;
+        memoKey.assign(1, instr.target);
+        for (int i = 0; i < callee.arity; ++i)
+            memoKey.push_back(i < bound ? evaluateOperand(program->callArgs[instr.argBegin + i]) : 0);
+        auto hit = memory->memo.find(memoKey);
+        if (hit != memory->memo.end()) {
+            memoCounters.hits++;
+            if (instr.dst >= 0) slots[instr.dst] = hit->second;
+            return;
+        }
+        memoCounters.misses++;
+    }
+
+    int base = caller.base + program->functions[caller.function].frameSize;
+    if (callDepth + 1 >= maxFrames || base + callee.frameSize > stackSlots) {
+        if (stacksCut) throw RunArena::Exhausted();
+        reportError() << "[ERROR] Stack overflow calling " << program->stringAt(callee.name) << endl;
+        instructionPointer = program->codeSize - 1;
         return;
     }
 
-    Frame newFrame;
-    newFrame.returnTarget = target;
+    int* calleeSlots = slotStack + base;
+    for (int i = 0; i < bound; ++i)
+        calleeSlots[i] = evaluateOperand(program->callArgs[instr.argBegin + i]);
+    fill(calleeSlots + bound, calleeSlots + callee.frameSize, 0);
+
+    Frame& frame = callStack[++callDepth];
+    frame.function = instr.target;
+    frame.base = base;
+    frame.returnTarget = instr.dst;
+    frame.returnAddress = instructionPointer;
+    frame.memoBase = -1;
+    if (memoise) {
+        pmr::vector<int>& keys = memory->memoKeyStack;
+        frame.memoBase = keys.size();
+        keys.insert(keys.end(), memory->memoKey.begin(), memory->memoKey.end());
+    }
+
+    slots = calleeSlots;
+    instructionPointer = callee.entry;
+}
 
-    int funcLine = functionMap[name];
-    for (size_t i = 0; i < args.size(); ++i) {
-        newFrame.variables["arg" + to_string(i)] = evaluateOperand(args[i]);
+// The callee reuses the caller's frame: its return target and address stay
+// as they are, so the eventual RETURN goes straight to the original caller.
+// Arguments are evaluated before the frame is overwritten.
+void IRInterpreter::tailCallFunction(const Instruction& instr) {
+    Frame& frame = callStack[callDepth];
+    const FunctionRecord& callee = program->functions[instr.target];
+    if (frame.base + callee.frameSize > stackSlots) {
+        if (stacksCut) throw RunArena::Exhausted();
+        reportError() << "[ERROR] Stack overflow calling " << program->stringAt(callee.name) << endl;
+        instructionPointer = program->codeSize - 1;
+        return;
     }
 
-    callStack.push(newFrame);
-    instructionPointer = functionMap[name] - 1;
+    int bound = min(instr.argCount, callee.arity);
+    pmr::vector<int>& argScratch = memory->argScratch;
+    argScratch.resize(bound);
+    for (int i = 0; i < bound; ++i)
+        argScratch[i] = evaluateOperand(program->callArgs[instr.argBegin + i]);
+    copy(argScratch.begin(), argScratch.end(), slots);
+    fill(slots + bound, slots + callee.frameSize, 0);
+
+    frame.function = instr.target;
+    instructionPointer = callee.entry;
+}
+
+void IRInterpreter::returnFromFunction(int value) {
+    if (callDepth == 0) {
+        instructionPointer = program->codeSize - 1;  // RETURN from the top level halts
+        return;
+    }
+    const Frame& finished = callStack[callDepth--];
+    if (finished.memoBase >= 0) {
+        // A tail call inside the frame still answers the call that created it
+        pmr::vector<int>& keys = memory->memoKeyStack;
+        if (memory->memo.size() < kMemoCapacity && !memoFull) {
+            try {
+                memory->memo.emplace(pmr::vector<int>(keys.begin() + finished.memoBase, keys.end(), arena.get()),
+                                     value);
+            } catch (const RunArena::Exhausted&) {
+                memoFull = true;  // only a cache: the run goes on without it
+            }
+        }
+        keys.resize(finished.memoBase);
+    }
+    slots = slotStack + callStack[callDepth].base;
+    if (finished.returnTarget >= 0) slots[finished.returnTarget] = value;
+    instructionPointer = finished.returnAddress;
 }
@@ -1,42 +1,20 @@
 #include "ir_optimizer.h"
-#include <fstream>
-#include <sstream>
-#include <iostream>
-#include <regex>
 #include <cctype>
 
 using namespace std;
 
-void IROptimizer::optimize(const string& inputPath, const string& outputPath) {
-    vector<string> irLines = readIR(inputPath);
-    vector<string> optimized = performOptimizations(irLines);
-    writeIR(optimized, outputPath);
+IRModule IROptimizer::optimize(const IRModule& input) {
+    IRModule output;
+    output.lines = performOptimizations(input.lines);
+    return output;
 }
 
-vector<string> IROptimizer::readIR(const string& path) {
-    ifstream inFile(path);
-    vector<string> lines;
-    string line;
-    while (getline(inFile, line)) {
-        lines.push_back(line);
-    }
-    return lines;
-}
-
-void IROptimizer::writeIR(const vector<string>& lines, const string& path) {
-    ofstream outFile(path);
-    for (const auto& line : lines) {
-        outFile << line << '\n';
-    }
-}
-
-vector<string> IROptimizer::performOptimizations(const vector<string>& lines) {
-    vector<string> optimized;
+vector<IRLine> IROptimizer::performOptimizations(const vector<IRLine>& lines) {
+    vector<IRLine> optimized;
 
     for (const auto& line : lines) {
-        if (line.find('=') != string::npos) {
-            string folded = foldConstants(line);
-            optimized.push_back(folded);
+        if (line.kind == IRLine::Binary) {
+            optimized.push_back(foldConstants(line));
         } else {
             optimized.push_back(line);
         }
@@ -45,20 +23,24 @@ vector<string> IROptimizer::performOptimizations(const vector<string>& lines) {
     return optimized;
 }
 
-string IROptimizer::foldConstants(const string& line) {
-    smatch match;
-    // Matches: t1 = 3 + 4
-    regex constExprRegex(R"(^\s*(t\d+)\s*=\s*(\d+)\s*([\+\-\*/%])\s*(\d+)\s*$)");
-    if (regex_match(line, match, constExprRegex)) {
-        string target = match[1];
-        string left = match[2];
-        string op = match[3];
-        string right = match[4];
+static bool isDigits(const string& text, size_t from = 0) {
+    if (text.size() <= from) return false;
+    for (size_t i = from; i < text.size(); ++i)
+        if (!isdigit(static_cast<unsigned char>(text[i]))) return false;
+    return true;
+}
 
-        string result = evaluateConstantExpr(left, op, right);
-        return target + " = " + result;
-    }
+// A temp computed from two unsigned literals with an arithmetic operator,
+// such as t1 = 3 + 4
+bool IROptimizer::isConstantExpression(const IRLine& line) {
+    return line.dst.size() > 1 && line.dst[0] == 't' && isDigits(line.dst, 1) &&
+           isDigits(line.a) && isDigits(line.b) && line.op.size() == 1 &&
+           string("+-*/%").find(line.op[0]) != string::npos;
+}
 
+IRLine IROptimizer::foldConstants(const IRLine& line) {
+    if (isConstantExpression(line))
+        return IRLine::copy(line.dst, evaluateConstantExpr(line.a, line.op, line.b));
     return line;
 }
 
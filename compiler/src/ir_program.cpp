@@ -0,0 +1,343 @@
+#include "ir_program.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PSEUDO_HAVE_MMAP 1
+#endif
+using namespace std;
+
+// Binary IR layout, in native byte order with 8-byte aligned sections:
+//
+//   FileHeader
+//   code           Instruction[]     (quickened is always 0 on disk)
+//   callArgs       Operand[]
+//   functions      FunctionRecord[]
+//   slotNames      int32_t[]         string index per function slot
+//   labels         LabelRecord[]
+//   stringOffsets  uint32_t[]        stringCount + 1 offsets into stringData
+//   stringData     char[]
+//   diagnostics    char[]            front-end warnings
+//   source         char[]            the source text compiled
+//
+// The records are written exactly as they sit in memory, so a file is only
+// valid for the build that wrote it: the header records the format version,
+// the byte order, sizeof(Instruction) and the number of opcodes, and load()
+// refuses anything that does not match.
+//
+// load() checks the header, that every section lies inside the file, and
+// that every slot, jump target, callee, call argument range and string
+// index stays inside its table, so that a file damaged on disk fails to
+// load instead of crashing whatever runs it.
+
+namespace {
+
+static_assert(is_trivially_copyable<Instruction>::value, "Instruction is written raw");
+static_assert(is_trivially_copyable<FunctionRecord>::value, "FunctionRecord is written raw");
+static_assert(sizeof(Instruction) == 40, "Instruction layout changed: bump kFormatVersion");
+
+#define IR_OPCODE_COUNT(name) +1
+const uint32_t kOpcodeCount = 0 IR_OPCODES(IR_OPCODE_COUNT);
+#undef IR_OPCODE_COUNT
+
+const char kMagic[4] = {'P', 'S', 'I', 'R'};
+const uint32_t kByteOrder = 0x01020304;
+const size_t kAlign = 8;
+
+struct Section {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t instructionSize;
+    uint32_t opcodeCount;
+    uint32_t reserved;
+    Section code, callArgs, functions, slotNames, labels, stringOffsets, stringData, diagnostics, source;
+};
+
+size_t alignUp(size_t n) {
+    return (n + kAlign - 1) & ~(kAlign - 1);
+}
+
+template <typename T>
+const T* sectionAt(const char* base, size_t size, const Section& section) {
+    if (section.offset % alignof(T) != 0 || section.offset > size ||
+        section.count > (size - section.offset) / sizeof(T))
+        return nullptr;
+    return reinterpret_cast<const T*>(base + section.offset);
+}
+
+bool isJump(OpCode op) {
+    switch (op) {
+    case OpCode::FunctionEntry: case OpCode::IfNotGoto: case OpCode::Goto:
+    case OpCode::IfNotEq: case OpCode::IfNotNe: case OpCode::IfNotLt:
+    case OpCode::IfNotLe: case OpCode::IfNotGt: case OpCode::IfNotGe:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Every index the interpreter follows without checking, against the table
+// it points into. Slots are checked against the frame of the function the
+// instruction belongs to, assigned the way IRDecoder lays functions out.
+bool indicesValid(const IRProgram& p) {
+    auto inRange = [](long long value, long long low, size_t end) {
+        return value >= low && value < static_cast<long long>(end);
+    };
+    auto stringOk = [&](int index) { return inRange(index, -1, p.stringCount); };
+
+    for (size_t i = 0; i < p.stringCount; ++i)
+        if (p.stringOffsets[i] > p.stringOffsets[i + 1]) return false;
+    for (size_t i = 0; i < p.slotNameCount; ++i)
+        if (!inRange(p.slotNames[i], 0, p.stringCount)) return false;
+    for (size_t f = 0; f < p.functionCount; ++f) {
+        const FunctionRecord& fn = p.functions[f];
+        if (!inRange(fn.entry, 0, p.codeSize) || !inRange(fn.exit, 0, p.codeSize) ||
+            fn.frameSize < 0 || fn.arity < 0 || fn.arity > fn.frameSize || fn.slotNames < 0 ||
+            static_cast<size_t>(fn.slotNames) + fn.frameSize > p.slotNameCount || !stringOk(fn.name))
+            return false;
+    }
+    for (size_t i = 0; i < p.labelCount; ++i)
+        if (!inRange(p.labels[i].target, -1, p.codeSize) || !stringOk(p.labels[i].name)) return false;
+
+    if (p.code[p.codeSize - 1].op != OpCode::Halt) return false;
+    size_t current = 0, nextFunction = 1;
+    for (size_t i = 0; i < p.codeSize; ++i) {
+        const Instruction& instr = p.code[i];
+        if (instr.op > OpCode::Halt || instr.quickened) return false;
+        if (instr.op == OpCode::FunctionEntry) {
+            if (nextFunction >= p.functionCount) return false;
+            current = nextFunction++;
+        }
+        int frame = p.functions[instr.op == OpCode::FunctionEntry ? 0 : current].frameSize;
+        auto operandOk = [&](const Operand& operand) {
+            if (operand.kind == Operand::Immediate) return true;
+            return operand.kind == Operand::Variable && inRange(operand.value, 0, frame);
+        };
+        if (!inRange(instr.dst, -1, frame) || !operandOk(instr.a) || !operandOk(instr.b) ||
+            !stringOk(instr.text) || instr.argBegin < 0 || instr.argCount < 0 ||
+            static_cast<size_t>(instr.argBegin) + instr.argCount > p.callArgCount)
+            return false;
+        for (int k = 0; k < instr.argCount; ++k)
+            if (!operandOk(p.callArgs[instr.argBegin + k])) return false;
+        if (isJump(instr.op) && !inRange(instr.target, -1, p.codeSize)) return false;
+        if (instr.op == OpCode::Call && !inRange(instr.target, -1, p.functionCount)) return false;
+        if (instr.op == OpCode::TailCall && (current == 0 || !inRange(instr.target, 0, p.functionCount)))
+            return false;
+        if (instr.op == OpCode::EndFunction) current = 0;
+    }
+    return true;
+}
+
+} // namespace
+
+IRProgram::~IRProgram() {
+#ifdef PSEUDO_HAVE_MMAP
+    if (mapping) munmap(mapping, mappingSize);
+#endif
+}
+
+shared_ptr<IRProgram> IRProgram::fromTables(Tables tables) {
+    shared_ptr<IRProgram> program = make_shared<IRProgram>();
+    program->owned = move(tables);
+    Tables& t = program->owned;
+
+    program->ownedOffsets.reserve(t.strings.size() + 1);
+    for (const string& s : t.strings) {
+        program->ownedOffsets.push_back(program->ownedData.size());
+        program->ownedData += s;
+    }
+    program->ownedOffsets.push_back(program->ownedData.size());
+
+    program->code = t.code.data();
+    program->codeSize = t.code.size();
+    program->callArgs = t.callArgs.data();
+    program->callArgCount = t.callArgs.size();
+    program->functions = t.functions.data();
+    program->functionCount = t.functions.size();
+    program->slotNames = t.slotNames.data();
+    program->slotNameCount = t.slotNames.size();
+    program->labels = t.labels.data();
+    program->labelCount = t.labels.size();
+    program->stringOffsets = program->ownedOffsets.data();
+    program->stringData = program->ownedData.data();
+    program->stringCount = t.strings.size();
+    return program;
+}
+
+void IRProgram::setDiagnostics(string text) {
+    ownedDiagnostics = move(text);
+    diagnostics = ownedDiagnostics;
+}
+
+void IRProgram::setSource(string text) {
+    ownedSource = move(text);
+    source = ownedSource;
+}
+
+bool IRProgram::save(const string& path, string& error) const {
+    FileHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kFormatVersion;
+    header.byteOrder = kByteOrder;
+    header.instructionSize = sizeof(Instruction);
+    header.opcodeCount = kOpcodeCount;
+
+    size_t offset = alignUp(sizeof(FileHeader));
+    auto place = [&offset](Section& section, size_t count, size_t elementSize) {
+        section.offset = offset;
+        section.count = count;
+        offset = alignUp(offset + count * elementSize);
+    };
+    place(header.code, codeSize, sizeof(Instruction));
+    place(header.callArgs, callArgCount, sizeof(Operand));
+    place(header.functions, functionCount, sizeof(FunctionRecord));
+    place(header.slotNames, slotNameCount, sizeof(int32_t));
+    place(header.labels, labelCount, sizeof(LabelRecord));
+    place(header.stringOffsets, stringCount + 1, sizeof(uint32_t));
+    place(header.stringData, stringOffsets[stringCount], 1);
+    place(header.diagnostics, diagnostics.size(), 1);
+    place(header.source, source.size(), 1);
+
+    // Assembled in memory so the file never holds a torn program
+    vector<char> image(offset, 0);
+    auto put = [&image](const Section& section, const void* data, size_t elementSize) {
+        if (section.count) memcpy(&image[section.offset], data, section.count * elementSize);
+    };
+    memcpy(image.data(), &header, sizeof(header));
+    put(header.code, code, sizeof(Instruction));
+    put(header.callArgs, callArgs, sizeof(Operand));
+    put(header.functions, functions, sizeof(FunctionRecord));
+    put(header.slotNames, slotNames, sizeof(int32_t));
+    put(header.labels, labels, sizeof(LabelRecord));
+    put(header.stringOffsets, stringOffsets, sizeof(uint32_t));
+    put(header.stringData, stringData, 1);
+    put(header.diagnostics, diagnostics.data(), 1);
+    put(header.source, source.data(), 1);
+
+    // A name no other writer uses: forked servers, batch workers and other
+    // editors may be saving the same program into a shared cache right now
+    static atomic<unsigned> saves{0};
+#ifdef PSEUDO_HAVE_MMAP
+    string writer = to_string(getpid());
+#else
+    string writer = to_string(chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    string temp = path + ".tmp." + writer + "." + to_string(saves++);
+    ofstream out(temp, ios::binary | ios::trunc);
+    out.write(image.data(), image.size());
+    out.close();
+    if (!out) {
+        error = "cannot write " + temp;
+        remove(temp.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(path.c_str());  // rename() does not replace on Windows
+#endif
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        error = "cannot rename " + temp + " to " + path;
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+shared_ptr<IRProgram> IRProgram::load(const string& path, string& error) {
+    shared_ptr<IRProgram> program = make_shared<IRProgram>();
+    const char* base = nullptr;
+    size_t size = 0;
+
+#ifdef PSEUDO_HAVE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileHeader)) {
+        close(fd);
+        error = path + " is not a binary IR file";
+        return nullptr;
+    }
+    size = st.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        error = "cannot map " + path;
+        return nullptr;
+    }
+    program->mapping = mapped;
+    program->mappingSize = size;
+    base = static_cast<const char*>(mapped);
+#else
+    ifstream in(path, ios::binary);
+    if (!in) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    program->fileBuffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    base = program->fileBuffer.data();
+    size = program->fileBuffer.size();
+    if (size < sizeof(FileHeader)) {
+        error = path + " is not a binary IR file";
+        return nullptr;
+    }
+#endif
+
+    FileHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        error = path + " is not a binary IR file";
+        return nullptr;
+    }
+    if (header.version != kFormatVersion || header.byteOrder != kByteOrder ||
+        header.instructionSize != sizeof(Instruction) || header.opcodeCount != kOpcodeCount) {
+        error = path + " was written by an incompatible compiler build";
+        return nullptr;
+    }
+
+    const Instruction* code = sectionAt<Instruction>(base, size, header.code);
+    program->callArgs = sectionAt<Operand>(base, size, header.callArgs);
+    program->functions = sectionAt<FunctionRecord>(base, size, header.functions);
+    program->slotNames = sectionAt<int32_t>(base, size, header.slotNames);
+    program->labels = sectionAt<LabelRecord>(base, size, header.labels);
+    program->stringOffsets = sectionAt<uint32_t>(base, size, header.stringOffsets);
+    program->stringData = sectionAt<char>(base, size, header.stringData);
+    const char* diagnostics = sectionAt<char>(base, size, header.diagnostics);
+    const char* source = sectionAt<char>(base, size, header.source);
+    if (!code || !program->callArgs || !program->functions || !program->slotNames ||
+        !program->labels || !program->stringOffsets || !program->stringData || !diagnostics || !source ||
+        header.code.count == 0 || header.functions.count == 0 || header.stringOffsets.count == 0 ||
+        program->stringOffsets[header.stringOffsets.count - 1] != header.stringData.count) {
+        error = path + " is truncated or corrupt";
+        return nullptr;
+    }
+
+    program->code = code;
+    program->codeSize = header.code.count;
+    program->callArgCount = header.callArgs.count;
+    program->functionCount = header.functions.count;
+    program->slotNameCount = header.slotNames.count;
+    program->labelCount = header.labels.count;
+    program->stringCount = header.stringOffsets.count - 1;
+    program->diagnostics = string_view(diagnostics, header.diagnostics.count);
+    program->source = string_view(source, header.source.count);
+    if (!indicesValid(*program)) {
+        error = path + " is truncated or corrupt";
+        return nullptr;
+    }
+    return program;
+}
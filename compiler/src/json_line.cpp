@@ -0,0 +1,124 @@
+#include "json_line.h"
+#include <cctype>
+#include <cstdlib>
+
+using namespace std;
+
+namespace {
+
+struct Cursor {
+    const string& text;
+    size_t pos = 0;
+
+    void skipSpace() {
+        while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) pos++;
+    }
+    bool consume(char c) {
+        skipSpace();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+};
+
+void appendUtf8(string& out, unsigned code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xc0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xe0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+}
+
+bool readHex4(Cursor& in, unsigned& code) {
+    if (in.pos + 4 > in.text.size()) return false;
+    string digits = in.text.substr(in.pos, 4);
+    for (char c : digits)
+        if (!isxdigit(static_cast<unsigned char>(c))) return false;
+    code = strtoul(digits.c_str(), nullptr, 16);
+    in.pos += 4;
+    return true;
+}
+
+bool readString(Cursor& in, string& out) {
+    if (!in.consume('"')) return false;
+    out.clear();
+    while (in.pos < in.text.size()) {
+        char c = in.text[in.pos++];
+        if (c == '"') return true;
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (in.pos >= in.text.size()) return false;
+        switch (in.text[in.pos++]) {
+        case '"':  out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/':  out += '/'; break;
+        case 'b':  out += '\b'; break;
+        case 'f':  out += '\f'; break;
+        case 'n':  out += '\n'; break;
+        case 'r':  out += '\r'; break;
+        case 't':  out += '\t'; break;
+        case 'u': {
+            unsigned code;
+            if (!readHex4(in, code)) return false;
+            // A surrogate pair encodes one code point above U+FFFF
+            if (code >= 0xd800 && code < 0xdc00 && in.text.compare(in.pos, 2, "\\u") == 0) {
+                in.pos += 2;
+                unsigned low;
+                if (!readHex4(in, low) || low < 0xdc00 || low > 0xdfff) return false;
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            }
+            appendUtf8(out, code);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return false;  // unterminated
+}
+
+bool readLiteral(Cursor& in, string& out) {
+    in.skipSpace();
+    size_t start = in.pos;
+    while (in.pos < in.text.size() && in.text[in.pos] != ',' && in.text[in.pos] != '}' &&
+           !isspace(static_cast<unsigned char>(in.text[in.pos])))
+        in.pos++;
+    out = in.text.substr(start, in.pos - start);
+    if (out.empty() || out[0] == '{' || out[0] == '[') return false;
+    return true;
+}
+
+} // namespace
+
+bool parseJsonLine(const string& line, unordered_map<string, string>& fields) {
+    Cursor in{line};
+    fields.clear();
+    if (!in.consume('{')) return false;
+    if (in.consume('}')) return true;
+    do {
+        string key, value;
+        if (!readString(in, key) || !in.consume(':')) return false;
+        in.skipSpace();
+        bool ok = in.pos < line.size() && line[in.pos] == '"' ? readString(in, value)
+                                                              : readLiteral(in, value);
+        if (!ok) return false;
+        fields[key] = value;
+    } while (in.consume(','));
+    if (!in.consume('}')) return false;
+    in.skipSpace();
+    return in.pos == line.size();
+}
@@ -2,11 +2,10 @@
 #include <cctype>
 #include <iostream>
 
-Lexer::Lexer(const string& input) : input(input), pos(0) {
-    currentChar = input.empty() ? '\0' : input[0];
-
-    // Define keywords
-    keywords = {
+// Built once per process, on first use; a fork server builds it before
+// forking so its workers share the pages
+const unordered_map<string, TokenType>& Lexer::keywords() {
+    static const unordered_map<string, TokenType> table = {
         {"START", TokenType::KEYWORD}, {"END", TokenType::KEYWORD},
         {"ARRAY", TokenType::KEYWORD}, {"STRUCT", TokenType::KEYWORD},
         {"IF", TokenType::KEYWORD}, {"THEN", TokenType::KEYWORD},{"ELSE", TokenType::KEYWORD},
@@ -19,6 +18,12 @@ Lexer::Lexer(const string& input) : input(input), pos(0) {
         {"FALSE", TokenType::BOOLEAN_LITERAL},
         {"AND", TokenType::KEYWORD}, {"OR", TokenType::KEYWORD}, {"NOT", TokenType::KEYWORD},{"READ", TokenType::KEYWORD}
     };
+    return table;
+}
+
+Lexer::Lexer(const string& input, ostream& diagnostics)
+    : input(input), pos(0), diagnostics(diagnostics) {
+    currentChar = input.empty() ? '\0' : input[0];
 }
 
 void Lexer::advance() {
@@ -60,7 +65,7 @@ Token Lexer::getString() {
     if (currentChar == '"') {
         advance(); // Skip closing quote
     } else {
-        cerr << "Error: Unterminated string literal!" << endl;
+        diagnostics << "Error: Unterminated string literal!" << endl;
     }
 
     return {TokenType::STRING, str};
@@ -74,8 +79,9 @@ Token Lexer::getIdentifier() {
         advance();
     }
 
-    if (keywords.count(id)) {
-        return {keywords[id], id}; // Fixed: return directly from keyword map
+    auto keyword = keywords().find(id);
+    if (keyword != keywords().end()) {
+        return {keyword->second, id};
     }
 
     return {TokenType::IDENTIFIER, id};
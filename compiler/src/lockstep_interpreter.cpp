@@ -0,0 +1,392 @@
+#include "lockstep_interpreter.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+
+// The lane loops below are written so GCC vectorises them. Where it can,
+// each is also built for AVX2 and picked at load time when the CPU has it;
+// the default clone keeps the binary running everywhere.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define PSEUDO_LANE_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define PSEUDO_LANE_KERNEL
+#endif
+
+namespace {
+// dst = a op b in the lanes of `mask`; the others keep their value
+PSEUDO_LANE_KERNEL
+void laneBinary(OpCode op, int32_t* dst, const int32_t* a, const int32_t* b,
+                const int32_t* mask, int n) {
+#define LANE_LOOP(expr)                                                   \
+    for (int l = 0; l < n; ++l) {                                         \
+        int32_t r = (expr);                                               \
+        dst[l] = (r & mask[l]) | (dst[l] & ~mask[l]);                     \
+    }                                                                     \
+    break;
+    switch (op) {
+    case OpCode::Copy: LANE_LOOP(a[l])
+    case OpCode::Add: LANE_LOOP(a[l] + b[l])
+    case OpCode::Sub: LANE_LOOP(a[l] - b[l])
+    case OpCode::Mul: LANE_LOOP(a[l] * b[l])
+    // See divideInt(); lanes outside the mask are not divided at all
+    case OpCode::Div: LANE_LOOP(mask[l] ? divideInt(a[l], b[l]) : 0)
+    case OpCode::Mod: LANE_LOOP(mask[l] ? remainderInt(a[l], b[l]) : 0)
+    case OpCode::Eq: LANE_LOOP(a[l] == b[l])
+    case OpCode::Ne: LANE_LOOP(a[l] != b[l])
+    case OpCode::Lt: LANE_LOOP(a[l] < b[l])
+    case OpCode::Le: LANE_LOOP(a[l] <= b[l])
+    case OpCode::Gt: LANE_LOOP(a[l] > b[l])
+    case OpCode::Ge: LANE_LOOP(a[l] >= b[l])
+    default: break;
+    }
+#undef LANE_LOOP
+}
+
+// jump = -1 in the lanes of `mask` where the branch is taken (its
+// condition is false); returns how many lanes take it
+PSEUDO_LANE_KERNEL
+int laneBranch(OpCode op, int32_t* jump, const int32_t* a, const int32_t* b,
+               const int32_t* mask, int n) {
+#define LANE_LOOP(cond)                                                   \
+    for (int l = 0; l < n; ++l) jump[l] = -static_cast<int32_t>(!(cond)) & mask[l]; \
+    break;
+    switch (op) {
+    case OpCode::IfNotGoto: LANE_LOOP(a[l])
+    case OpCode::IfNotEq: LANE_LOOP(a[l] == b[l])
+    case OpCode::IfNotNe: LANE_LOOP(a[l] != b[l])
+    case OpCode::IfNotLt: LANE_LOOP(a[l] < b[l])
+    case OpCode::IfNotLe: LANE_LOOP(a[l] <= b[l])
+    case OpCode::IfNotGt: LANE_LOOP(a[l] > b[l])
+    case OpCode::IfNotGe: LANE_LOOP(a[l] >= b[l])
+    default: break;
+    }
+#undef LANE_LOOP
+    int taken = 0;
+    for (int l = 0; l < n; ++l) taken += jump[l] & 1;
+    return taken;
+}
+}
+
+// No calls, and no RETURN outside a function body (function bodies are then
+// unreachable, as FUNCTION skips over them)
+bool LockstepInterpreter::supports(const IRProgram& program) {
+    vector<bool> inBody(program.codeSize, false);
+    for (size_t f = 1; f < program.functionCount; ++f)
+        for (int i = program.functions[f].entry; i <= program.functions[f].exit; ++i) inBody[i] = true;
+    for (size_t i = 0; i < program.codeSize; ++i) {
+        OpCode op = program.code[i].op;
+        if (op == OpCode::Call || op == OpCode::TailCall) return false;
+        if ((op == OpCode::Return || op == OpCode::EndFunction) && !inBody[i]) return false;
+        if (op > OpCode::Halt) return false;  // quickened forms live only in a run's copy
+    }
+    return true;
+}
+
+const int32_t* LockstepInterpreter::source(const Operand& operand, int32_t* scratch) {
+    if (operand.kind == Operand::Variable) return row(operand.value);
+    fill(scratch, scratch + width, operand.value);
+    return scratch;
+}
+
+// Credits the instructions run since the mask last changed to its lanes
+void LockstepInterpreter::flushSteps() {
+    for (size_t l = 0; l < lanes->size(); ++l)
+        if (mask[l]) (*lanes)[l].instructions += steps;
+    steps = 0;
+}
+
+void LockstepInterpreter::park(const int32_t* lanesMask, int target) {
+    int count = 0;
+    for (size_t l = 0; l < lanes->size(); ++l) {
+        if (!lanesMask[l]) continue;
+        parkedAt[l] = target;
+        count++;
+    }
+    if (count) parked[target] += count;
+}
+
+// Adds the lanes waiting at `target` to the running group
+void LockstepInterpreter::unpark(int target) {
+    parked.erase(target);
+    for (size_t l = 0; l < lanes->size(); ++l) {
+        if (parkedAt[l] != target) continue;
+        parkedAt[l] = -1;
+        mask[l] = -1;
+    }
+}
+
+// The running group continues at `next`, unless lanes wait at a lower
+// target: then the group waits at `next` and the lowest waiting lanes run
+void LockstepInterpreter::moveTo(int next) {
+    if (!parked.empty() && parked.begin()->first <= next) {
+        flushSteps();
+        int lowest = parked.begin()->first;
+        if (lowest < next) {
+            park(mask.data(), next);
+            fill(mask.begin(), mask.end(), 0);
+        }
+        unpark(lowest);
+        next = lowest;
+    }
+    pc = next;
+}
+
+// The lanes stop. Returns whether some of the running group is left;
+// if not, the lowest waiting lanes run next, or the run is over.
+bool LockstepInterpreter::haltLanes(const int32_t* lanesMask) {
+    flushSteps();
+    bool anyLeft = false;
+    for (int l = 0; l < width; ++l) {
+        if (lanesMask[l]) mask[l] = 0;
+        anyLeft = anyLeft || mask[l];
+    }
+    if (anyLeft) return true;
+    if (parked.empty()) {
+        pc = -1;
+        return false;
+    }
+    int lowest = parked.begin()->first;
+    unpark(lowest);
+    pc = lowest;
+    return false;
+}
+
+// Halts the running lanes that went over a limit. Returns whether any did;
+// the group, and pc, may then have changed.
+bool LockstepInterpreter::haltOverLimit() {
+    flushSteps();
+    bool overTime = limits.milliseconds &&
+                    chrono::steady_clock::now() - started >= chrono::milliseconds(limits.milliseconds);
+    bool any = false;
+    fill(jump.begin(), jump.end(), 0);
+    for (size_t l = 0; l < lanes->size(); ++l) {
+        if (!mask[l]) continue;
+        Lane& lane = (*lanes)[l];
+        if (limits.instructions && lane.instructions >= limits.instructions)
+            lane.exceeded = IRInterpreter::Limit::Instructions;
+        else if (overTime)
+            lane.exceeded = IRInterpreter::Limit::Time;
+        else
+            continue;
+        jump[l] = -1;
+        any = true;
+    }
+    if (any) haltLanes(jump.data());
+    return any;
+}
+
+void LockstepInterpreter::read(const Instruction& instr) {
+    string varName(program->slotName(0, instr.dst));
+    int32_t* dst = row(instr.dst);
+    fill(jump.begin(), jump.end(), 0);   // lanes whose input ran out
+    bool exhausted = false;
+    for (size_t l = 0; l < lanes->size(); ++l) {
+        if (!mask[l]) continue;
+        Lane& lane = (*lanes)[l];
+        writers[l]->event("input", "prompt", "Enter value for " + varName + ":");
+        writers[l]->flush();
+        string value;
+        if (!lane.input || !lane.input->readLine(value)) {
+            if (!(cancelFlag && cancelFlag->load(memory_order_relaxed)))
+                *lane.errors << "[ERROR] No input available for " << varName << endl;
+            lane.instructions++;  // the HALT a single run would execute next
+            jump[l] = -1;
+            exhausted = true;
+            continue;
+        }
+        dst[l] = strtol(value.c_str(), nullptr, 10);
+    }
+    steps++;
+    if (exhausted && !haltLanes(jump.data())) return;
+    moveTo(pc + 1);
+}
+
+IRInterpreter::RunStatus LockstepInterpreter::run(const IRProgram& code, vector<Lane>& runLanes) {
+    program = &code;
+    lanes = &runLanes;
+    int count = static_cast<int>(runLanes.size());
+    width = (count + 7) & ~7;
+    int frameSize = program->functions[0].frameSize;
+    slotData.assign(static_cast<size_t>(max(frameSize, 1)) * width, 0);
+    mask.assign(width, 0);
+    fill(mask.begin(), mask.begin() + count, -1);
+    jump.assign(width, 0);
+    scratchA.assign(width, 0);
+    scratchB.assign(width, 0);
+    parkedAt.assign(width, -1);
+    parked.clear();
+    writers.clear();
+    for (Lane& lane : runLanes) {
+        lane.instructions = 0;
+        lane.exceeded = IRInterpreter::Limit::None;
+        writers.push_back(make_unique<OutputWriter>());
+        if (lane.output) writers.back()->setSink(lane.output);
+    }
+    pc = count ? 0 : -1;
+    steps = 0;
+
+    IRInterpreter::RunStatus status = IRInterpreter::RunStatus::Finished;
+    bool limited = limits.instructions || limits.milliseconds;
+    bool checkLimits = false;   // due at the next instruction boundary
+    started = chrono::steady_clock::now();
+    int fuel = kCheckInterval;
+    while (pc >= 0) {
+        if (checkLimits) {
+            checkLimits = false;
+            if (haltOverLimit()) continue;
+        }
+        const Instruction& instr = program->code[pc];
+        switch (instr.op) {
+        case OpCode::Copy:
+        case OpCode::Add: case OpCode::Sub: case OpCode::Mul: case OpCode::Div: case OpCode::Mod:
+        case OpCode::Eq: case OpCode::Ne: case OpCode::Lt: case OpCode::Le: case OpCode::Gt: case OpCode::Ge:
+            laneBinary(instr.op, row(instr.dst), source(instr.a, scratchA.data()),
+                       instr.op == OpCode::Copy ? nullptr : source(instr.b, scratchB.data()),
+                       mask.data(), width);
+            steps++;
+            moveTo(pc + 1);
+            break;
+
+        case OpCode::Print:
+        case OpCode::PrintString:
+        case OpCode::Access: {
+            string text(program->stringAt(instr.text));
+            const int32_t* a = source(instr.a, scratchA.data());
+            fill(jump.begin(), jump.end(), 0);   // lanes the line would take over the output limit
+            bool over = false;
+            for (size_t l = 0; l < runLanes.size(); ++l) {
+                if (!mask[l]) continue;
+                string message;
+                if (instr.op == OpCode::Print)
+                    message = text + " = " + to_string(a[l]);
+                else if (instr.op == OpCode::PrintString)
+                    message = text;
+                else  // arrays are never written, so every element reads 0
+                    message = text + "[" + to_string(a[l]) + "] = 0";
+                if (limits.outputBytes && writers[l]->bytesWritten() + message.size() > limits.outputBytes) {
+                    runLanes[l].exceeded = IRInterpreter::Limit::OutputBytes;
+                    jump[l] = -1;
+                    over = true;
+                    continue;
+                }
+                writers[l]->event("output", "message", message);
+            }
+            steps++;
+            if (over && !haltLanes(jump.data())) break;
+            moveTo(pc + 1);
+            break;
+        }
+
+        case OpCode::Read:
+            read(instr);
+            break;
+
+        case OpCode::IfNotGoto:
+        case OpCode::IfNotEq: case OpCode::IfNotNe: case OpCode::IfNotLt:
+        case OpCode::IfNotLe: case OpCode::IfNotGt: case OpCode::IfNotGe: {
+            const int32_t* a = source(instr.a, scratchA.data());
+            const int32_t* b = instr.op == OpCode::IfNotGoto ? nullptr : source(instr.b, scratchB.data());
+            int taken = laneBranch(instr.op, jump.data(), a, b, mask.data(), width);
+            steps++;
+            if (taken && instr.target < 0) {
+                for (size_t l = 0; l < runLanes.size(); ++l)
+                    if (jump[l]) *runLanes[l].errors << "[ERROR] Label not found: "
+                                                     << program->stringAt(instr.text) << endl;
+                taken = 0;
+            }
+            if (taken == 0) {
+                moveTo(pc + 1);
+                break;
+            }
+            int active = 0;
+            for (int l = 0; l < width; ++l) active += mask[l] & 1;
+            if (--fuel == 0) {
+                fuel = kCheckInterval;
+                if (cancelFlag && cancelFlag->load(memory_order_relaxed)) {
+                    status = IRInterpreter::RunStatus::Cancelled;
+                    pc = -1;
+                    break;
+                }
+                checkLimits = limited;
+            }
+            if (taken == active) {
+                moveTo(instr.target);
+                break;
+            }
+            // Split: the lower of the two continues, the other waits
+            flushSteps();
+            if (instr.target < pc + 1) {
+                for (int l = 0; l < width; ++l) scratchA[l] = mask[l] & ~jump[l];
+                park(scratchA.data(), pc + 1);
+                mask.swap(jump);
+                moveTo(instr.target);
+            } else {
+                park(jump.data(), instr.target);
+                for (int l = 0; l < width; ++l) mask[l] &= ~jump[l];
+                moveTo(pc + 1);
+            }
+            break;
+        }
+
+        case OpCode::Goto:
+        case OpCode::FunctionEntry:
+            steps++;
+            if (instr.target < 0) {
+                for (size_t l = 0; l < runLanes.size(); ++l)
+                    if (mask[l]) *runLanes[l].errors << "[ERROR] Label not found: "
+                                                     << program->stringAt(instr.text) << endl;
+                moveTo(pc + 1);
+                break;
+            }
+            if (--fuel == 0) {
+                fuel = kCheckInterval;
+                if (cancelFlag && cancelFlag->load(memory_order_relaxed)) {
+                    status = IRInterpreter::RunStatus::Cancelled;
+                    pc = -1;
+                    break;
+                }
+                checkLimits = limited;
+            }
+            moveTo(instr.target);
+            break;
+
+        case OpCode::Unknown:
+            for (size_t l = 0; l < runLanes.size(); ++l)
+                if (mask[l]) *runLanes[l].errors << "[WARNING] Unknown instruction: "
+                                                 << program->stringAt(instr.text) << endl;
+            steps++;
+            moveTo(pc + 1);
+            break;
+
+        case OpCode::Nop:
+            steps++;
+            moveTo(pc + 1);
+            break;
+
+        case OpCode::Halt:
+            steps++;
+            haltLanes(mask.data());
+            break;
+
+        default:  // calls and quickened forms; supports() rules them out
+            *runLanes[0].errors << "[ERROR] Lockstep execution cannot run this program" << endl;
+            status = IRInterpreter::RunStatus::Cancelled;
+            pc = -1;
+            break;
+        }
+    }
+    flushSteps();
+    // Lanes that went over a limit and halted before the next check
+    if (status == IRInterpreter::RunStatus::Finished) {
+        for (size_t l = 0; l < runLanes.size(); ++l) {
+            Lane& lane = runLanes[l];
+            if (lane.exceeded != IRInterpreter::Limit::None) continue;
+            if (limits.instructions && lane.instructions > limits.instructions)
+                lane.exceeded = IRInterpreter::Limit::Instructions;
+        }
+    }
+    writers.clear();  // flushes the remaining output
+    return status;
+}
@@ -1,28 +1,129 @@
-#include "../include/lexer.h"
-#include "../include/parser.h"
-#include "semantic_analyzer.h"
 #include <iostream>
 #include <string>
-#include <vector>
 #include <memory>
 #include <fstream>
 #include <filesystem>
-#include "../include/ir_generator.h"
-#include "../include/ir_optimizer.h"
+#include "../include/batch_runner.h"
+#include "../include/compile_cache.h"
+#include "../include/compiler_session.h"
+#include "../include/compiler_server.h"
+#include "../include/fork_server.h"
+#include "../include/grade_runner.h"
+#include "../include/websocket_server.h"
 #include "../include/ir_interpreter.h"
+#include "../include/metrics_exporter.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
-void printAST(const unique_ptr<ASTNode>& node, ostream& parsedFile, int depth = 0) {
-    for (int i = 0; i < depth; i++) parsedFile << "  ";
-    parsedFile << node->type << ": " << node->value << endl;
-    for (const auto& child : node->children) {
-        printAST(child, parsedFile, depth + 1);
+int main(int argc, char* argv[]) {
+    IRInterpreter::DispatchMode dispatchMode = IRInterpreter::DispatchMode::Threaded;
+    bool quickening = true;
+    bool memoization = true;
+    bool stats = false;
+    bool stdinInput = false;
+    bool dump = false;
+    bool serve = false;
+    int websocketPort = 0;       // --websocket: serve the editor protocol directly
+    string forkSocket;           // --fork-server: Unix socket of the pre-forked workers
+    string batchPath;            // --batch: directory or manifest of programs
+    string gradeDir;             // --grade: test cases for the compiled program
+    unsigned jobs = 0;           // serve/fork/batch/grade workers, 0 = one per hardware thread
+    unsigned long long sliceInstructions = 1ull << 20;  // --slice: --serve preemption, 0 = off
+    IRInterpreter::Limits limits;  // --max-instructions, --max-time (ms), --max-output (bytes),
+                                   // --max-memory (MiB)
+    bool lockstep = false;       // --lockstep: grade cases as SIMD lanes
+    string sourcePath;           // program to compile instead of tests/input.txt
+    string emitIrPath;           // save the decoded program as binary IR
+    string runIrPath;            // run binary IR instead of compiling input.txt
+    string cacheDir;             // compile cache, off unless given
+    uintmax_t cacheBytes = 64ull << 20;
+    string metricsFile;          // Prometheus text, rewritten while running and at exit
+    int metricsPort = 0;         // GET /metrics on 127.0.0.1
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--dispatch=switch") {
+            dispatchMode = IRInterpreter::DispatchMode::Switch;
+        } else if (arg == "--dispatch=threaded") {
+            dispatchMode = IRInterpreter::DispatchMode::Threaded;
+            if (!IRInterpreter::threadedDispatchAvailable())
+                cerr << "Threaded dispatch not available in this build, using switch" << endl;
+        } else if (arg == "--no-quicken") {
+            quickening = false;
+        } else if (arg == "--no-memo") {
+            memoization = false;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--input=stdin") {
+            stdinInput = true;
+        } else if (arg == "--input=file") {
+            stdinInput = false;
+        } else if (arg == "--dump") {
+            dump = true;
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--websocket") {
+            websocketPort = 8080;
+        } else if (arg.rfind("--websocket=", 0) == 0) {
+            websocketPort = atoi(arg.c_str() + 12);
+        } else if (arg.rfind("--fork-server=", 0) == 0) {
+            forkSocket = arg.substr(14);
+        } else if (arg.rfind("--batch=", 0) == 0) {
+            batchPath = arg.substr(8);
+        } else if (arg.rfind("--grade=", 0) == 0) {
+            gradeDir = arg.substr(8);
+        } else if (arg == "--lockstep") {
+            lockstep = true;
+        } else if (arg.rfind("--source=", 0) == 0) {
+            sourcePath = arg.substr(9);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            jobs = strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--slice=", 0) == 0) {
+            sliceInstructions = strtoull(arg.c_str() + 8, nullptr, 10);
+        } else if (arg.rfind("--max-instructions=", 0) == 0) {
+            limits.instructions = strtoull(arg.c_str() + 19, nullptr, 10);
+        } else if (arg.rfind("--max-time=", 0) == 0) {
+            limits.milliseconds = strtoull(arg.c_str() + 11, nullptr, 10);
+        } else if (arg.rfind("--max-output=", 0) == 0) {
+            limits.outputBytes = strtoull(arg.c_str() + 13, nullptr, 10);
+        } else if (arg.rfind("--max-memory=", 0) == 0) {
+            limits.memoryBytes = strtoull(arg.c_str() + 13, nullptr, 10) << 20;  // MiB
+        } else if (arg.rfind("--emit-ir=", 0) == 0) {
+            emitIrPath = arg.substr(10);
+        } else if (arg.rfind("--run-ir=", 0) == 0) {
+            runIrPath = arg.substr(9);
+        } else if (arg.rfind("--cache-dir=", 0) == 0) {
+            cacheDir = arg.substr(12);
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            cacheBytes = strtoull(arg.c_str() + 13, nullptr, 10) << 20;  // MiB
+        } else if (arg.rfind("--metrics-file=", 0) == 0) {
+            metricsFile = arg.substr(15);
+        } else if (arg.rfind("--metrics-port=", 0) == 0) {
+            metricsPort = atoi(arg.c_str() + 15);
+        } else {
+            cerr << "Unknown option: " << arg << endl;
+            return 1;
+        }
+    }
+
+    MetricsExporter metrics(metricsFile, metricsPort);
+    if (!metrics.start()) return 1;
+
+    ServeOptions options;
+    options.dispatchMode = dispatchMode;
+    options.quickening = quickening;
+    options.memoization = memoization;
+    options.cacheDir = cacheDir;
+    options.cacheBytes = cacheBytes;
+    options.sliceInstructions = sliceInstructions;
+    options.limits = limits;
+    if (serve || websocketPort || !batchPath.empty() || !forkSocket.empty()) {
+        if (!batchPath.empty()) return BatchRunner(options, jobs).run(batchPath);
+        if (!forkSocket.empty()) return ForkServer(options, forkSocket, jobs).serve();
+        if (websocketPort) return WebSocketServer(options, websocketPort).serve();
+        return CompilerServer(options, jobs).serve(cin);
     }
-}
 
-int main() {
     // Get current working directory (should be compiler/build/Debug/)
     fs::path cwd = fs::current_path();
 
@@ -30,55 +131,87 @@ int main() {
     fs::path testsDir = cwd.parent_path().parent_path() / "tests";
 
     // Define all paths inside tests
-    fs::path inputPath = testsDir / "input.txt";
+    fs::path inputPath = sourcePath.empty() ? testsDir / "input.txt" : fs::path(sourcePath);
     fs::path tokensPath = testsDir / "tokens.txt";
     fs::path astPath = testsDir / "ast.txt";
     fs::path irPath = testsDir / "ir_generated.txt";
     fs::path optIrPath = testsDir / "optimized_ir.txt";
     fs::path finalOutputPath = testsDir / "output.txt";
+    fs::path inputQueuePath = testsDir / "input_queue.txt";
 
-    // Read input code from input.txt
-    ifstream inputFile(inputPath);
-    if (!inputFile) {
-        cerr << "Failed to open input file: " << inputPath << endl;
-        return 1;
-    }
-    string code((istreambuf_iterator<char>(inputFile)), istreambuf_iterator<char>());
+    unique_ptr<CompileCache> cache;
+    if (!cacheDir.empty()) cache = make_unique<CompileCache>(cacheDir, cacheBytes);
 
-    // Lexing
-    Lexer lexer(code);
-    vector<Token> tokens = lexer.tokenize();
-
-    // Write tokens to file
-    ofstream tokenFile(tokensPath);
-    for (const Token& token : tokens) {
-        tokenFile << token.type << " -> " << token.value << endl;
-    }
+    unique_ptr<InputChannel> input;
+    if (stdinInput) input = make_unique<StdinInputChannel>();
+    else input = make_unique<FileInputChannel>(inputQueuePath.string());
 
-    // Parsing
-    Parser parser(tokens);
-    unique_ptr<ASTNode> root = parser.parse();
+    CompilerSession session;
+    session.setDispatchMode(dispatchMode);
+    session.setQuickening(quickening);
+    session.setMemoization(memoization);
+    session.setCache(cache.get());
+    session.setInputChannel(input.get());
+    session.setLimits(limits);
 
-    // Print AST
-    ofstream astFile(astPath);
-    printAST(root, astFile);
+    shared_ptr<const IRProgram> program;
+    string error;
+    if (!runIrPath.empty()) {
+        program = IRProgram::load(runIrPath, error);
+        if (!program) {
+            cerr << "Failed to load binary IR: " << error << endl;
+            return 1;
+        }
+    } else {
+        // Read input code from input.txt
+        ifstream inputFile(inputPath);
+        if (!inputFile) {
+            cerr << "Failed to open input file: " << inputPath << endl;
+            return 1;
+        }
+        string code(istreambuf_iterator<char>(inputFile), {});
 
-    // Semantic Analysis
-    SemanticAnalyzer semanticAnalyzer;
-    semanticAnalyzer.analyze(root.get());
-
-    // IR Generation
-    IRGenerator irGen(irPath.string());
-    irGen.generate(root.get());
+        // --dump needs every stage to run, so it bypasses the cache
+        CompileDumps dumps;
+        dumps.tokens = tokensPath.string();
+        dumps.ast = astPath.string();
+        dumps.ir = irPath.string();
+        dumps.optimizedIr = optIrPath.string();
+        program = session.compile(code, dump ? &dumps : nullptr);
+        if (!program) {
+            cerr << session.compileError() << endl;
+            return 1;
+        }
+    }
+    if (!emitIrPath.empty() && !program->save(emitIrPath, error)) {
+        cerr << "Failed to write binary IR: " << error << endl;
+        return 1;
+    }
 
-    // IR Optimization
-    IROptimizer optimizer;
-    optimizer.optimize(irPath.string(), optIrPath.string());
+    // Compiled once, then run against every case
+    if (!gradeDir.empty()) {
+        GradeRunner grader(options, jobs);
+        grader.setLockstep(lockstep);
+        return grader.run(program, gradeDir);
+    }
 
     // IR Interpretation - output written to output.txt
     //ofstream execOutput(finalOutputPath);
-    IRInterpreter executor;
-    executor.interpret(optIrPath.string());
+    bool overLimit = session.run(program) == IRInterpreter::RunStatus::LimitExceeded;
+    if (overLimit)
+        cerr << "[ERROR] Run stopped: " << IRInterpreter::limitName(session.exceededLimit())
+             << " limit exceeded" << endl;
+
+    if (stats) {
+        IRInterpreter::MemoStats memo = session.memoStats();
+        cerr << "memo: hits=" << memo.hits << " misses=" << memo.misses
+             << " entries=" << memo.entries << endl;
+        if (cache) {
+            CompileCache::Stats cached = cache->stats();
+            cerr << "cache: hits=" << cached.hits << " misses=" << cached.misses
+                 << " evictions=" << cached.evictions << endl;
+        }
+    }
 
-    return 0;
+    return overLimit ? 1 : 0;
 }
@@ -0,0 +1,182 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <new>
+#include <sstream>
+#include "ir_interpreter.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define PSEUDO_HAVE_MMAP 1
+#endif
+using namespace std;
+
+static_assert(atomic<uint64_t>::is_always_lock_free,
+              "metrics are shared with forked workers and must not need a lock");
+
+static int highestBit(uint64_t value) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) ++bit;
+    return bit;
+#endif
+}
+
+// Below 2^(kSubBits + 1) the index is the value itself; above, the top
+// kSubBits + 1 bits of the value pick the bucket within its power of two
+int Histogram::bucketOf(uint64_t value) {
+    if (value < (1u << (kSubBits + 1))) return static_cast<int>(value);
+    int exponent = highestBit(value);
+    if (exponent >= kMaxExponent) return kBuckets - 1;
+    int shift = exponent - kSubBits;
+    return ((exponent - kSubBits + 1) << kSubBits) + static_cast<int>((value >> shift) & ((1u << kSubBits) - 1));
+}
+
+void Histogram::record(uint64_t value) {
+    buckets[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(value, memory_order_relaxed);
+}
+
+chrono::steady_clock::time_point Histogram::recordSince(chrono::steady_clock::time_point start) {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    record(chrono::duration_cast<chrono::nanoseconds>(now - start).count());
+    return now;
+}
+
+// The count is taken from the buckets rather than kept apart, so the
+// quantiles always agree with it
+void Histogram::snapshot(Snapshot& into) const {
+    into.count = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        into.buckets[i] = buckets[i].load(memory_order_relaxed);
+        into.count += into.buckets[i];
+    }
+    into.sum = sum.load(memory_order_relaxed);
+}
+
+void Histogram::clear() {
+    for (auto& bucket : buckets) bucket.store(0, memory_order_relaxed);
+    sum.store(0, memory_order_relaxed);
+}
+
+double Histogram::Snapshot::quantile(double q) const {
+    if (!count) return 0;
+    uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(q * count)));
+    uint64_t seen = 0;
+    int i = 0;
+    for (; i < kBuckets - 1; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) break;
+    }
+    if (i < (1 << (kSubBits + 1))) return i;
+    int shift = (i >> kSubBits) - 1;
+    uint64_t low = static_cast<uint64_t>((i & ((1 << kSubBits) - 1)) | (1 << kSubBits)) << shift;
+    return low + ((1ull << shift) - 1) / 2.0;
+}
+
+Metrics& Metrics::global() {
+    static Metrics* metrics = [] {
+#ifdef PSEUDO_HAVE_MMAP
+        void* shared = mmap(nullptr, sizeof(Metrics), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared != MAP_FAILED) return new (shared) Metrics();
+#endif
+        return new Metrics();
+    }();
+    return *metrics;
+}
+
+void Metrics::clear() {
+    for (Counter* counter : {&compiles, &compileErrors, &cacheHits, &cacheMisses, &cacheEvictions,
+                             &instructions, &outputBytes})
+        counter->clear();
+    for (Counter& counter : runs) counter.clear();
+    for (Counter& counter : limitsExceeded) counter.clear();
+    compileTime.clear();
+    for (Histogram& histogram : phaseTime) histogram.clear();
+    runTime.clear();
+}
+
+namespace {
+
+const char* const phaseNames[Metrics::kPhases] = {
+    "lex", "parse", "semantic", "generate", "optimize", "decode"};
+const char* const runEndNames[Metrics::kRunEnds] = {"finished", "cancelled", "limit-exceeded"};
+const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+void family(ostream& out, const char* name, const char* type, const char* help) {
+    out << "# HELP " << name << ' ' << help << '\n';
+    out << "# TYPE " << name << ' ' << type << '\n';
+}
+
+// `labels` is empty or `key="value"`
+void series(ostream& out, const char* name, const string& labels, uint64_t value) {
+    out << name;
+    if (!labels.empty()) out << '{' << labels << '}';
+    out << ' ' << value << '\n';
+}
+
+void counter(ostream& out, const char* name, const char* help, const Counter& value) {
+    family(out, name, "counter", help);
+    series(out, name, "", value.load());
+}
+
+// Nanoseconds in, seconds out
+void summary(ostream& out, const char* name, const string& labels, const Histogram& histogram,
+             Histogram::Snapshot& snapshot) {
+    histogram.snapshot(snapshot);
+    string prefix = labels.empty() ? "" : labels + ",";
+    for (double q : kQuantiles) {
+        out << name << '{' << prefix << "quantile=\"" << q << "\"} ";
+        if (snapshot.count) out << snapshot.quantile(q) * 1e-9 << '\n';
+        else out << "NaN\n";
+    }
+    out << name << "_sum";
+    if (!labels.empty()) out << '{' << labels << '}';
+    out << ' ' << snapshot.sum * 1e-9 << '\n';
+    out << name << "_count";
+    if (!labels.empty()) out << '{' << labels << '}';
+    out << ' ' << snapshot.count << '\n';
+}
+
+}
+
+string Metrics::prometheus() const {
+    ostringstream out;
+    out.precision(9);
+    auto snapshot = make_unique<Histogram::Snapshot>();   // 10 KB, reused for every histogram
+
+    counter(out, "pseudo_compiles_total", "Compile requests, cache hits included.", compiles);
+    counter(out, "pseudo_compile_errors_total", "Compile requests that ended in a parse error.",
+            compileErrors);
+    counter(out, "pseudo_compile_cache_hits_total", "Compiles answered from the compile cache.",
+            cacheHits);
+    counter(out, "pseudo_compile_cache_misses_total",
+            "Compiles the compile cache was asked for and did not have.", cacheMisses);
+    counter(out, "pseudo_compile_cache_evictions_total", "Entries evicted from the compile cache.",
+            cacheEvictions);
+    family(out, "pseudo_compile_seconds", "summary",
+           "Time to answer a compile request, cache lookup included.");
+    summary(out, "pseudo_compile_seconds", "", compileTime, *snapshot);
+    family(out, "pseudo_compile_phase_seconds", "summary", "Time spent in each compiler phase.");
+    for (int phase = 0; phase < kPhases; ++phase)
+        summary(out, "pseudo_compile_phase_seconds", string("phase=\"") + phaseNames[phase] + "\"",
+                phaseTime[phase], *snapshot);
+
+    family(out, "pseudo_runs_total", "counter", "Runs that ended, by how they ended.");
+    for (int end = 0; end < kRunEnds; ++end)
+        series(out, "pseudo_runs_total", string("status=\"") + runEndNames[end] + "\"", runs[end].load());
+    family(out, "pseudo_run_limits_exceeded_total", "counter", "Runs stopped by a limit, by limit.");
+    for (int limit = 1; limit < 5; ++limit)
+        series(out, "pseudo_run_limits_exceeded_total",
+               string("limit=\"") + IRInterpreter::limitName(static_cast<IRInterpreter::Limit>(limit)) + "\"",
+               limitsExceeded[limit].load());
+    counter(out, "pseudo_instructions_total", "IR instructions executed.", instructions);
+    counter(out, "pseudo_output_bytes_total", "Bytes of program output.", outputBytes);
+    family(out, "pseudo_run_seconds", "summary",
+           "Time a run spent executing, without waits for input or for a worker.");
+    summary(out, "pseudo_run_seconds", "", runTime, *snapshot);
+    return out.str();
+}
@@ -0,0 +1,149 @@
+#include "metrics_exporter.h"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "metrics.h"
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MetricsExporter::MetricsExporter(const string& filePath, int port) : filePath(filePath), port(port) {}
+
+MetricsExporter::~MetricsExporter() {
+    if (thread.joinable()) {
+        {
+            lock_guard<mutex> lock(stopMutex);
+            stopping = true;
+        }
+        stopped.notify_one();
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+#endif
+        thread.join();
+    }
+#ifdef __linux__
+    if (listenFd >= 0) close(listenFd);
+    if (wakeFd >= 0) close(wakeFd);
+#endif
+    if (!filePath.empty()) writeFile();
+}
+
+bool MetricsExporter::start() {
+    if (filePath.empty() && !port) return true;
+    Metrics::global();  // before any fork, so forked workers share it
+    if (port) {
+#ifdef __linux__
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // never exposed beyond localhost
+        if (listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 ||
+            listen(listenFd, SOMAXCONN) != 0) {
+            cerr << "Cannot serve metrics on 127.0.0.1:" << port << ": " << strerror(errno) << endl;
+            return false;
+        }
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+#else
+        cerr << "--metrics-port is only available on Linux" << endl;
+        return false;
+#endif
+    }
+    thread = std::thread([this] { loop(); });
+    return true;
+}
+
+void MetricsExporter::loop() {
+    auto nextWrite = chrono::steady_clock::now() + chrono::seconds(kFileSeconds);
+    for (;;) {
+        chrono::steady_clock::duration timeout = chrono::hours(24);
+        if (!filePath.empty()) timeout = nextWrite - chrono::steady_clock::now();
+#ifdef __linux__
+        if (listenFd >= 0) {
+            pollfd fds[2] = {{listenFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+            int millis = static_cast<int>(max<long long>(
+                0, chrono::duration_cast<chrono::milliseconds>(timeout).count()));
+            int ready = poll(fds, 2, millis);
+            if (fds[1].revents) return;
+            if (ready > 0 && fds[0].revents) {
+                int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0) {
+                    answer(fd);
+                    close(fd);
+                }
+            }
+        } else
+#endif
+        {
+            unique_lock<mutex> lock(stopMutex);
+            if (stopped.wait_for(lock, timeout, [this] { return stopping; })) return;
+        }
+        if (!filePath.empty() && chrono::steady_clock::now() >= nextWrite) {
+            writeFile();
+            nextWrite = chrono::steady_clock::now() + chrono::seconds(kFileSeconds);
+        }
+    }
+}
+
+void MetricsExporter::writeFile() {
+    string temporary = filePath + ".tmp";
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        file << Metrics::global().prometheus();
+        if (!file) {
+            cerr << "Cannot write metrics to " << temporary << endl;
+            return;
+        }
+    }
+    if (rename(temporary.c_str(), filePath.c_str()) != 0)
+        cerr << "Cannot replace " << filePath << ": " << strerror(errno) << endl;
+}
+
+// One request per connection. A client gets a second to send its request
+// line, so a stalled one cannot hold up the next scrape for long.
+void MetricsExporter::answer(int fd) {
+#ifdef __linux__
+    timeval patience = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &patience, sizeof(patience));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &patience, sizeof(patience));
+    string request;
+    char chunk[1024];
+    while (request.find("\r\n") == string::npos && request.size() < 8192) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return;
+        request.append(chunk, n);
+    }
+
+    string response;
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET / ", 0) == 0) {
+        string body = Metrics::global().prometheus();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                   to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    } else {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        sent += n;
+    }
+#else
+    (void)fd;
+#endif
+}
@@ -0,0 +1,109 @@
+#include "output_writer.h"
+
+using namespace std;
+
+OutputWriter::OutputWriter(FILE* stream) : stream(stream), lastFlush(chrono::steady_clock::now()) {
+    buffer.reserve(kFlushBytes + 256);
+}
+
+OutputWriter::~OutputWriter() {
+    flush();
+}
+
+void OutputWriter::event(const string& type, const string& key, const string& value) {
+    appendEvent(buffer, session, type, key, value);
+    written += value.size();
+
+    if (buffer.size() >= kFlushBytes ||
+        chrono::steady_clock::now() - lastFlush >= chrono::milliseconds(kFlushMillis))
+        flush();
+}
+
+void OutputWriter::flushIfStale() {
+    if (!buffer.empty() && chrono::steady_clock::now() - lastFlush >= chrono::milliseconds(kFlushMillis))
+        flush();
+}
+
+void OutputWriter::appendEvent(string& out, const string& session, const string& type,
+                               const string& key, const string& value) {
+    out += "{";
+    if (!session.empty()) {
+        out += "\"session\":\"";
+        appendEscaped(out, session);
+        out += "\",";
+    }
+    out += "\"type\":\"";
+    appendEscaped(out, type);
+    out += "\",\"";
+    appendEscaped(out, key);
+    out += "\":\"";
+    appendEscaped(out, value);
+    out += "\"}\n";
+}
+
+void OutputWriter::appendEvent(string& out, const string& session, const string& type,
+                               const vector<pair<string, string>>& fields) {
+    out += "{";
+    if (!session.empty()) {
+        out += "\"session\":\"";
+        appendEscaped(out, session);
+        out += "\",";
+    }
+    out += "\"type\":\"";
+    appendEscaped(out, type);
+    out += "\"";
+    for (const auto& field : fields) {
+        out += ",\"";
+        appendEscaped(out, field.first);
+        out += "\":\"";
+        appendEscaped(out, field.second);
+        out += "\"";
+    }
+    out += "}\n";
+}
+
+// Whole events are written with a single fwrite, which stdio performs under
+// the stream lock, so writers on several threads never split each other's lines.
+void OutputWriter::flush() {
+    if (sink) {
+        if (!buffer.empty()) sink(buffer);
+    } else {
+        if (!buffer.empty()) fwrite(buffer.data(), 1, buffer.size(), stream);
+        fflush(stream);
+    }
+    buffer.clear();
+    lastFlush = chrono::steady_clock::now();
+}
+
+void OutputWriter::appendEscaped(string& out, const string& text) {
+    static const char hex[] = "0123456789abcdef";
+    for (unsigned char c : text) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xf];
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+}
+
+int LineEvents::sync() {
+    string text = str();
+    size_t begin = 0, end;
+    while ((end = text.find('\n', begin)) != string::npos) {
+        emit(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    str("");
+    sputn(text.data() + begin, text.size() - begin);
+    return 0;
+}
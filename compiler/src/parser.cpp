@@ -5,7 +5,8 @@
 #include "../include/ast.h"
 #include <vector>
 
-Parser::Parser(std::vector<Token> tokens) : tokens(tokens), currentPos(0) {}
+Parser::Parser(std::vector<Token> tokens, std::ostream& diagnostics)
+    : tokens(tokens), currentPos(0), diagnostics(diagnostics) {}
 
 Token Parser::currentToken() {
     return (currentPos < tokens.size()) ? tokens[currentPos] : Token{TokenType::END_OF_FILE, "EOF"};
@@ -29,7 +30,7 @@ std::unique_ptr<ASTNode> Parser::parse() {
         if (stmt) {
             root->children.push_back(std::move(stmt));
         } else {
-            std::cerr << "Error: Failed to parse statement at token '" << currentToken().value << "'\n";
+            diagnostics << "Error: Failed to parse statement at token '" << currentToken().value << "'\n";
             advance();  // Prevent infinite loop
         }
     }
@@ -37,7 +38,7 @@ std::unique_ptr<ASTNode> Parser::parse() {
     if (currentToken().value == "END") {
         advance(); // Good
     } else if (currentToken().type != TokenType::END_OF_FILE) {
-        std::cerr << "Error: Missing 'END' keyword.\n";
+        diagnostics << "Error: Missing 'END' keyword.\n";
     }
     
 
@@ -71,7 +72,7 @@ std::unique_ptr<ASTNode> Parser::parseStatement() {
     } else if (currentToken().value == "STRUCT") {
         return parseStructDeclaration();
     } else {
-        std::cerr << "Error: Unexpected token '" << currentToken().value << "'\n";
+        diagnostics << "Error: Unexpected token '" << currentToken().value << "'\n";
         return nullptr;
     }
 }
@@ -81,7 +82,7 @@ std::unique_ptr<ASTNode> Parser::parseInputStatement() {
 
     Token identifier = currentToken();
     if (identifier.type != TokenType::IDENTIFIER) {
-        throw std::runtime_error("Expected an identifier after 'READ'");
+        throw ParseError("Error: Expected an identifier after 'READ'");
     }
     advance(); // Consume the identifier
 
@@ -166,9 +167,9 @@ std::unique_ptr<ASTNode> Parser::parseFactor() {
         return std::make_unique<ASTNode>("Boolean", token.value);
     }
     else if (token.type == TokenType::IDENTIFIER) {
-        if (tokens[currentPos + 1].value == "(") {
+        if (peek().value == "(") {
             return parseFunctionCall();
-        } else if (tokens[currentPos + 1].value == "[") {
+        } else if (peek().value == "[") {
             return parseArrayAccess();
         }
         advance();
@@ -180,13 +181,14 @@ std::unique_ptr<ASTNode> Parser::parseFactor() {
         if (currentToken().value == ")") {
             advance();
         } else {
-            std::cerr << "Error: Expected closing parenthesis.\n";
+            diagnostics << "Error: Expected closing parenthesis.\n";
         }
         return expr;
     }
 
-    std::cerr << "Error: Unexpected token '" << token.value << "' in expression.\n";
-    return nullptr;
+    // Every expression node needs its operands, so there is nothing to
+    // recover with
+    throw ParseError("Error: Unexpected token '" + token.value + "' in expression.");
 }
 
 
@@ -324,7 +326,7 @@ std::unique_ptr<ASTNode> Parser::parseLoopStatement() {
         if (stmt) {
             loopNode->children.push_back(std::move(stmt));
         } else {
-            std::cerr << "Error: Invalid statement inside loop.\n";
+            diagnostics << "Error: Invalid statement inside loop.\n";
             advance();
         }
     }
@@ -332,7 +334,7 @@ std::unique_ptr<ASTNode> Parser::parseLoopStatement() {
     if (currentToken().value == "ENDWHILE" || currentToken().value == "ENDFOR") {
         advance();
     } else {
-        std::cerr << "Error: Missing 'ENDWHILE' or 'ENDFOR' keyword in loop.\n";
+        diagnostics << "Error: Missing 'ENDWHILE' or 'ENDFOR' keyword in loop.\n";
     }
 
     return loopNode;
@@ -364,8 +366,7 @@ std::vector<std::string> Parser::parseParameterList() {
 
 void Parser::expect(const std::string& expectedValue) {
     if (currentToken().value != expectedValue) {
-        std::cerr << "Error: Expected '" << expectedValue << "' but got '" << currentToken().value << "'\n";
-        exit(EXIT_FAILURE);
+        throw ParseError("Error: Expected '" + expectedValue + "' but got '" + currentToken().value + "'");
     }
     advance();  // Move to the next token
 }
@@ -404,7 +405,7 @@ std::unique_ptr<ASTNode> Parser::parseFunctionDeclaration() {
             if (stmt) {
                 funcNode->children.push_back(std::move(stmt));
             } else {
-                std::cerr << "Error: Invalid statement inside function.\n";
+                diagnostics << "Error: Invalid statement inside function.\n";
                 advance();  // Skip to continue parsing
             }
         }
@@ -433,24 +434,23 @@ std::unique_ptr<ASTNode> Parser::parseStructDeclaration() {
                 if (currentToken().value == ";") {
                     advance(); // Move past ';'
                 } else {
-                    std::cerr << "Error: Expected ';' after struct field.\n";
+                    diagnostics << "Error: Expected ';' after struct field.\n";
                 }
             }
 
             if (currentToken().value == "}") {
                 advance(); // Move past '}'
             } else {
-                std::cerr << "Error: Expected '}' at the end of struct declaration.\n";
+                diagnostics << "Error: Expected '}' at the end of struct declaration.\n";
             }
         } else {
-            std::cerr << "Error: Expected '{' after struct name.\n";
+            diagnostics << "Error: Expected '{' after struct name.\n";
         }
 
         return structNode;
     }
 
-    std::cerr << "Error: Expected struct name.\n";
-    return nullptr;
+    throw ParseError("Error: Expected struct name.");
 }
 
 std::unique_ptr<ASTNode> Parser::parseArrayAccess() {
@@ -464,10 +464,10 @@ std::unique_ptr<ASTNode> Parser::parseArrayAccess() {
         if (currentToken().value == "]") {
             advance(); // Move past ']'
         } else {
-            std::cerr << "Error: Expected ']' after array index.\n";
+            diagnostics << "Error: Expected ']' after array index.\n";
         }
     } else {
-        std::cerr << "Error: Expected '[' for array access.\n";
+        diagnostics << "Error: Expected '[' for array access.\n";
     }
 
     return arrayNode;
@@ -483,17 +483,17 @@ std::unique_ptr<ASTNode> Parser::parseFunctionCall() {
         advance(); // Move past '('
         
         while (currentToken().value != ")" && currentToken().type != TokenType::END_OF_FILE) {
-            funcNode->children.push_back(parseExpression());
+            funcNode->children.push_back(parseExpression());  // consumes a token or throws
             if (currentToken().value == ",") advance();
         }
 
         if (currentToken().value == ")") {
             advance(); // Move past ')'
         } else {
-            std::cerr << "Error: Expected ')' after function arguments.\n";
+            diagnostics << "Error: Expected ')' after function arguments.\n";
         }
     } else {
-        std::cerr << "Error: Expected '(' after function name.\n";
+        diagnostics << "Error: Expected '(' after function name.\n";
     }
 
     return funcNode;
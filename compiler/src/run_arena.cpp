@@ -0,0 +1,55 @@
+#include "run_arena.h"
+#include <algorithm>
+#include <cstdint>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define PSEUDO_HAVE_MMAP 1
+#endif
+using namespace std;
+
+RunArena::RunArena(size_t quota) : quotaBytes(quota) {}
+
+RunArena::~RunArena() {
+    for (const Block& block : blocks) {
+#ifdef PSEUDO_HAVE_MMAP
+        munmap(block.base, block.size);
+#else
+        ::operator delete(block.base);
+#endif
+    }
+}
+
+// Anonymous mappings come zeroed and page aligned, and cost nothing until
+// a page is written
+void* RunArena::newBlock(size_t size) {
+    if (quotaBytes && size > quotaBytes - total) throw Exhausted();
+#ifdef PSEUDO_HAVE_MMAP
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) throw bad_alloc();
+#else
+    void* base = ::operator new(size);
+#endif
+    blocks.push_back(Block{base, size});
+    total += size;
+    return base;
+}
+
+void* RunArena::do_allocate(size_t bytes, size_t alignment) {
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+    if (cursor && aligned + bytes <= reinterpret_cast<uintptr_t>(limit)) {
+        cursor = reinterpret_cast<char*>(aligned + bytes);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // Large requests (the frame and slot stacks) get a block of their own
+    // and leave the current one in use
+    if (bytes > nextBlock / 2) return newBlock(bytes);
+
+    size_t size = nextBlock;
+    if (quotaBytes && size > quotaBytes - total) size = max(bytes, quotaBytes - total);
+    char* base = static_cast<char*>(newBlock(size));
+    nextBlock = min(nextBlock * 2, kMaxBlock);
+    cursor = base + bytes;   // blocks are page aligned
+    limit = base + size;
+    return base;
+}
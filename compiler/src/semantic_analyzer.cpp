@@ -19,19 +19,17 @@ void SemanticAnalyzer::analyzeNode(ASTNode* node, const std::string& currentFunc
         std::string funcName = node->value;
         functionTable.insert(funcName);
 
-        if (node->children.size() >= 2) {
-            ASTNode* paramList = node->children[1].get();
-            int paramCount = static_cast<int>(paramList->children.size());
-            functionParamCount[funcName] = paramCount;
-
-            // Declare parameters in symbolTable
-            for (const auto& param : paramList->children) {
-                symbolTable[param->value] = "int"; // Assume all are int for simplicity
-            }
+        // The parser puts Parameter nodes first, followed by the body
+        int paramCount = 0;
+        for (const auto& child : node->children) {
+            if (child->type != "Parameter") break;
+            symbolTable[child->value] = "int"; // Assume all are int for simplicity
+            paramCount++;
         }
+        functionParamCount[funcName] = paramCount;
 
         // Analyze function body
-        for (size_t i = 2; i < node->children.size(); ++i) {
+        for (size_t i = paramCount; i < node->children.size(); ++i) {
             analyzeNode(node->children[i].get(), funcName);
         }
 
@@ -42,10 +40,12 @@ void SemanticAnalyzer::analyzeNode(ASTNode* node, const std::string& currentFunc
     if (node->type == "ReturnStatement") {
         std::string returnType = evaluateExpressionType(node->children[0].get());
 
-        if (functionReturnTypes.find(currentFunction) == functionReturnTypes.end()) {
+        if (returnType == "unknown") {
+            // Nothing to compare against (e.g. the result of an arithmetic expression)
+        } else if (functionReturnTypes.find(currentFunction) == functionReturnTypes.end()) {
             functionReturnTypes[currentFunction] = returnType;
         } else if (functionReturnTypes[currentFunction] != returnType) {
-            std::cout << "Semantic Error: Inconsistent return types in function '" << currentFunction << "'.\n";
+            diagnostics << "Semantic Error: Inconsistent return types in function '" << currentFunction << "'.\n";
         }
     }
 
@@ -79,10 +79,10 @@ void SemanticAnalyzer::analyzeNode(ASTNode* node, const std::string& currentFunc
 
         if (structFields.find(structType) != structFields.end()) {
             if (structFields[structType].find(field) == structFields[structType].end()) {
-                std::cout << "Semantic Error: Field '" << field << "' not found in struct '" << structType << "'.\n";
+                diagnostics << "Semantic Error: Field '" << field << "' not found in struct '" << structType << "'.\n";
             }
         } else {
-            std::cout << "Semantic Error: Struct type '" << structType << "' not declared.\n";
+            diagnostics << "Semantic Error: Struct type '" << structType << "' not declared.\n";
         }
     }
 
@@ -105,20 +105,18 @@ void SemanticAnalyzer::analyzeNode(ASTNode* node, const std::string& currentFunc
 
 
 void SemanticAnalyzer::checkFunctionCall(ASTNode* node) {
-    if (node->children.empty()) return;
-
     std::string funcName = node->value;
 
     if (functionParamCount.find(funcName) != functionParamCount.end()) {
         int expected = functionParamCount[funcName];
-        int given = countArgs(node->children[0].get());
+        int given = countArgs(node);
 
         if (expected != given) {
-            std::cout << "Semantic Error: Function '" << funcName << "' expects " << expected
+            diagnostics << "Semantic Error: Function '" << funcName << "' expects " << expected
                       << " parameter(s), but " << given << " were provided.\n";
         }
     } else {
-        std::cout << "Semantic Warning: Function '" << funcName << "' called but not declared.\n";
+        diagnostics << "Semantic Warning: Function '" << funcName << "' called but not declared.\n";
     }
 }
 
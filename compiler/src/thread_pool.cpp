@@ -0,0 +1,82 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+// Which worker of which pool the current thread is, for submit()
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local unsigned currentWorker = 0;
+}
+
+ThreadPool::ThreadPool(unsigned count) {
+    if (count == 0) count = max(1u, thread::hardware_concurrency());
+    for (unsigned i = 0; i < count; ++i) workers.push_back(make_unique<Worker>());
+    for (unsigned i = 0; i < count; ++i) threads.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(stateMutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (thread& worker : threads) worker.join();
+}
+
+void ThreadPool::submit(function<void()> job, Priority priority) {
+    unsigned index = currentPool == this ? currentWorker
+                                         : nextWorker.fetch_add(1) % workers.size();
+    {
+        lock_guard<mutex> lock(workers[index]->dequeMutex);
+        workers[index]->jobs[static_cast<int>(priority)].push_back(move(job));
+    }
+    {
+        lock_guard<mutex> lock(stateMutex);
+        queued++;
+        pending++;
+    }
+    available.notify_one();
+}
+
+void ThreadPool::wait() {
+    unique_lock<mutex> lock(stateMutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+// Oldest job of the own deque, then of the others in turn; every
+// interactive deque before any batch one, except on a batch turn
+bool ThreadPool::take(unsigned index, function<void()>& job) {
+    int first = ++workers[index]->taken % kBatchTurn == 0 ? 1 : 0;
+    for (int turn = 0; turn < 2; ++turn) {
+        int priority = first ^ turn;
+        for (size_t n = 0; n < workers.size(); ++n) {
+            Worker& victim = *workers[(index + n) % workers.size()];
+            lock_guard<mutex> lock(victim.dequeMutex);
+            deque<function<void()>>& jobs = victim.jobs[priority];
+            if (jobs.empty()) continue;
+            job = move(jobs.front());
+            jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(unsigned index) {
+    currentPool = this;
+    currentWorker = index;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(stateMutex);
+            available.wait(lock, [this] { return stopping || queued > 0; });
+            if (queued == 0) return;  // stopping, and nothing left to do
+            queued--;                 // claims one job; take() below finds it
+        }
+        function<void()> job;
+        take(index, job);  // cannot miss: a job is in a deque before it is counted
+        job();
+        lock_guard<mutex> lock(stateMutex);
+        if (--pending == 0) idle.notify_all();
+    }
+}
@@ -0,0 +1,544 @@
+#include "websocket_server.h"
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "compiler_session.h"
+#include "input_channel.h"
+#include "json_line.h"
+#include "output_writer.h"
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifndef __linux__
+
+struct WebSocketServer::Connection {};
+struct WebSocketServer::Run {};
+
+WebSocketServer::WebSocketServer(const ServeOptions& options, int port)
+    : options(options), port(port) {}
+
+WebSocketServer::~WebSocketServer() {}
+
+int WebSocketServer::serve() {
+    cerr << "--websocket is only available on Linux" << endl;
+    return 1;
+}
+
+#else
+
+namespace {
+
+// SHA-1 and base64 are only needed for Sec-WebSocket-Accept (RFC 6455 4.2.2)
+string sha1(const string& text) {
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    string data = text;
+    uint64_t bits = static_cast<uint64_t>(text.size()) * 8;
+    data += static_cast<char>(0x80);
+    while (data.size() % 64 != 56) data += '\0';
+    for (int i = 7; i >= 0; --i) data += static_cast<char>(bits >> (i * 8));
+
+    auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(&data[chunk + i * 4]);
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 80; ++i) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5a827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else             { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+            uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rotl(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    string digest;
+    for (uint32_t v : h)
+        for (int i = 3; i >= 0; --i) digest += static_cast<char>(v >> (i * 8));
+    return digest;
+}
+
+string base64(const string& bytes) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string out;
+    size_t i = 0;
+    for (; i + 2 < bytes.size(); i += 3) {
+        uint32_t v = (unsigned char)bytes[i] << 16 | (unsigned char)bytes[i + 1] << 8 | (unsigned char)bytes[i + 2];
+        out += table[v >> 18];
+        out += table[(v >> 12) & 63];
+        out += table[(v >> 6) & 63];
+        out += table[v & 63];
+    }
+    if (i < bytes.size()) {
+        uint32_t v = (unsigned char)bytes[i] << 16;
+        if (i + 1 < bytes.size()) v |= (unsigned char)bytes[i + 1] << 8;
+        out += table[v >> 18];
+        out += table[(v >> 12) & 63];
+        out += i + 1 < bytes.size() ? table[(v >> 6) & 63] : '=';
+        out += '=';
+    }
+    return out;
+}
+
+enum Opcode : uint8_t { Continuation = 0, Text = 1, Binary = 2, Close = 8, Ping = 9, Pong = 10 };
+
+string frame(uint8_t opcode, const string& payload) {
+    string out;
+    out += static_cast<char>(0x80 | opcode);
+    uint64_t n = payload.size();
+    if (n < 126) {
+        out += static_cast<char>(n);
+    } else if (n <= 0xffff) {
+        out += static_cast<char>(126);
+        out += static_cast<char>(n >> 8);
+        out += static_cast<char>(n);
+    } else {
+        out += static_cast<char>(127);
+        for (int i = 7; i >= 0; --i) out += static_cast<char>(n >> (i * 8));
+    }
+    return out + payload;
+}
+
+string closeFrame(uint16_t code) {
+    string payload;
+    payload += static_cast<char>(code >> 8);
+    payload += static_cast<char>(code);
+    return frame(Close, payload);
+}
+
+string lower(string text) {
+    transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return tolower(c); });
+    return text;
+}
+
+string trim(const string& text) {
+    size_t begin = text.find_first_not_of(" \t");
+    size_t end = text.find_last_not_of(" \t\r");
+    return begin == string::npos ? "" : text.substr(begin, end - begin + 1);
+}
+
+} // namespace
+
+// One program run. The thread is joined by whoever holds the Run last: the
+// next run of the connection, or reapRuns() once the connection is closed.
+struct WebSocketServer::Run {
+    QueueInputChannel input;
+    atomic<bool> cancel{false};
+    atomic<bool> done{false};
+    shared_ptr<Run> previous;   // cancelled; joined before this run starts
+    thread worker;
+};
+
+struct WebSocketServer::Connection : enable_shared_from_this<Connection> {
+    int fd = -1;
+    string in;                  // bytes not yet parsed (loop thread only)
+    string message;             // fragments of the message being received
+    bool upgraded = false;
+    bool closing = false;       // close once the outbox drains
+    bool watchingWrite = false;
+
+    mutex outMutex;
+    condition_variable drained;
+    string outbox;              // bytes waiting for the socket
+
+    shared_ptr<Run> run;        // the current run (loop thread only)
+};
+
+WebSocketServer::WebSocketServer(const ServeOptions& options, int port)
+    : options(options), port(port) {
+    if (!options.cacheDir.empty())
+        cache = make_unique<CompileCache>(options.cacheDir, options.cacheBytes);
+}
+
+WebSocketServer::~WebSocketServer() {
+    vector<int> open;
+    for (auto& entry : connections) open.push_back(entry.first);
+    for (int fd : open) closeConnection(fd);
+    reapRuns(true);
+    if (listenFd >= 0) close(listenFd);
+    if (wakeFd >= 0) close(wakeFd);
+    if (epollFd >= 0) close(epollFd);
+}
+
+int WebSocketServer::serve() {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // never exposed beyond localhost
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        cerr << "Cannot listen on 127.0.0.1:" << port << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event listenEvent = {};
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent);
+    epoll_event wakeEvent = {};
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEvent);
+    cerr << "WebSocket server running on ws://127.0.0.1:" << port << endl;
+
+    epoll_event events[64];
+    for (;;) {
+        int n = epoll_wait(epollFd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            cerr << "epoll_wait: " << strerror(errno) << endl;
+            return 1;
+        }
+
+        vector<int> finished;
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                acceptConnections();
+            } else if (fd == wakeFd) {
+                uint64_t count;
+                ssize_t drainedBytes = read(wakeFd, &count, sizeof(count));
+                (void)drainedBytes;
+                for (auto& entry : connections)
+                    if (!flushOutbox(*entry.second)) finished.push_back(entry.first);
+                reapRuns(false);
+            } else {
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                Connection& connection = *it->second;
+                bool open = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                if (open && (events[i].events & EPOLLIN)) open = receive(connection);
+                if (open) open = flushOutbox(connection);
+                if (!open) finished.push_back(fd);
+            }
+        }
+
+        sort(finished.begin(), finished.end());
+        finished.erase(unique(finished.begin(), finished.end()), finished.end());
+        for (int fd : finished) closeConnection(fd);
+    }
+}
+
+void WebSocketServer::acceptConnections() {
+    for (;;) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;  // EAGAIN: nothing left to accept
+        auto connection = make_shared<Connection>();
+        connection->fd = fd;
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        connections[fd] = move(connection);
+    }
+}
+
+// Returns false when the connection should be closed right away
+bool WebSocketServer::receive(Connection& connection) {
+    char buffer[16384];
+    for (;;) {
+        ssize_t n = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            connection.in.append(buffer, n);
+            continue;
+        }
+        if (n == 0) return false;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno != EINTR) return false;
+    }
+    if (connection.closing) return true;  // waiting for the outbox to drain
+    if (!connection.upgraded && !handshake(connection)) return false;
+    return !connection.upgraded || readFrames(connection);
+}
+
+bool WebSocketServer::handshake(Connection& connection) {
+    size_t end = connection.in.find("\r\n\r\n");
+    if (end == string::npos) return connection.in.size() < 8192;
+
+    istringstream request(connection.in.substr(0, end));
+    connection.in.erase(0, end + 4);
+    string line, key;
+    bool upgrade = false;
+    getline(request, line);  // GET / HTTP/1.1
+    while (getline(request, line)) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        string name = lower(trim(line.substr(0, colon)));
+        string value = trim(line.substr(colon + 1));
+        if (name == "upgrade") upgrade = lower(value).find("websocket") != string::npos;
+        else if (name == "sec-websocket-key") key = value;
+    }
+
+    if (!upgrade || key.empty()) {
+        queue(connection, "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+        connection.closing = true;
+        return true;
+    }
+    string accept = base64(sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+    queue(connection, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                      "Connection: Upgrade\r\nSec-WebSocket-Accept: " + accept + "\r\n\r\n");
+    connection.upgraded = true;
+    sendText(connection, "Connected to Compiler Server");
+    return true;
+}
+
+bool WebSocketServer::readFrames(Connection& connection) {
+    string& in = connection.in;
+    while (in.size() >= 2 && !connection.closing) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(in.data());
+        bool fin = p[0] & 0x80;
+        uint8_t opcode = p[0] & 0x0f;
+        bool masked = p[1] & 0x80;
+        uint64_t length = p[1] & 0x7f;
+        size_t header = 2;
+        if (length == 126) {
+            if (in.size() < 4) return true;
+            length = (uint64_t)p[2] << 8 | p[3];
+            header = 4;
+        } else if (length == 127) {
+            if (in.size() < 10) return true;
+            length = 0;
+            for (int i = 0; i < 8; ++i) length = length << 8 | p[2 + i];
+            header = 10;
+        }
+        if (!masked || length + connection.message.size() > kMaxMessage) {
+            // Clients must mask; oversized messages are refused (1002 / 1009)
+            queue(connection, closeFrame(masked ? 1009 : 1002));
+            connection.closing = true;
+            return true;
+        }
+        if (in.size() < header + 4 + length) return true;
+
+        const unsigned char* mask = p + header;
+        string payload(in, header + 4, length);
+        for (size_t i = 0; i < payload.size(); ++i) payload[i] ^= mask[i % 4];
+        in.erase(0, header + 4 + length);
+
+        switch (opcode) {
+        case Continuation:
+        case Text:
+        case Binary:
+            connection.message += payload;
+            if (fin) {
+                string message;
+                message.swap(connection.message);
+                onMessage(connection, message);
+            }
+            break;
+        case Close:
+            queue(connection, frame(Close, payload.substr(0, 2)));
+            connection.closing = true;
+            break;
+        case Ping:
+            queue(connection, frame(Pong, payload));
+            break;
+        case Pong:
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// Same dispatch as server.js: JSON is a control message, anything else is code
+void WebSocketServer::onMessage(Connection& connection, const string& text) {
+    unordered_map<string, string> fields;
+    if (!parseJsonLine(text, fields)) {
+        startRun(connection, text);
+        return;
+    }
+    if (fields["type"] == "input" && connection.run && !connection.run->done)
+        connection.run->input.push(fields["value"]);
+}
+
+void WebSocketServer::startRun(Connection& connection, const string& code) {
+    stopRun(connection);
+    auto run = make_shared<Run>();
+    run->previous = move(connection.run);
+    connection.run = run;
+    // The thread keeps the connection alive, not the Run: that is joined
+    // by its successor or by reapRuns()
+    run->worker = thread([this, self = connection.shared_from_this(), target = run.get(), code] {
+        runProgram(*self, *target, code);
+        target->done = true;
+        wake();
+    });
+}
+
+// Runs on the run's own thread
+void WebSocketServer::runProgram(Connection& connection, Run& run, const string& code) {
+    if (run.previous) {
+        // The replaced run's last output goes first
+        run.previous->worker.join();
+        run.previous.reset();
+    }
+    if (run.cancel) return;
+
+    auto output = [this, &connection, &run](const string& message) {
+        string event;
+        OutputWriter::appendEvent(event, "", "output", "message", message);
+        event.pop_back();  // one event per frame, no newline
+        queue(connection, frame(Text, event), &run);
+        wake();
+    };
+
+    CompilerSession session;
+    session.setDispatchMode(options.dispatchMode);
+    session.setQuickening(options.quickening);
+    session.setMemoization(options.memoization);
+    session.setCache(cache.get());
+    session.setLimits(options.limits);
+    ostringstream diagnostics;
+    session.setDiagnostics(diagnostics);
+    shared_ptr<const IRProgram> program = session.compile(code);
+    istringstream lines(diagnostics.str());
+    string message;
+    while (getline(lines, message)) output(message);
+    if (!program) {
+        output(session.compileError());
+        output("\n[Process exited with code 1]");
+        return;
+    }
+
+    // Runtime errors are shown like output, as server.js showed the old
+    // compiler's stderr
+    LineEvents errorEvents(output);
+    ostream errors(&errorEvents);
+    session.setErrorStream(errors);
+    session.setInputChannel(&run.input);
+    session.setCancelFlag(&run.cancel);
+    session.setOutputSink([this, &connection, &run](const string& lines) {
+        size_t begin = 0, end;
+        while ((end = lines.find('\n', begin)) != string::npos) {
+            queue(connection, frame(Text, lines.substr(begin, end - begin)), &run);
+            begin = end + 1;
+        }
+        wake();
+    });
+    IRInterpreter::RunStatus status = session.run(program);
+    errors.flush();
+    if (status == IRInterpreter::RunStatus::LimitExceeded)
+        output(string("\n[Run stopped: ") + IRInterpreter::limitName(session.exceededLimit()) +
+               " limit exceeded]");
+    else if (status == IRInterpreter::RunStatus::Cancelled)
+        output("\n[Run cancelled]");
+    else
+        output(session.errorReported() ? "\n[Process exited with code 1]"
+                                       : "\n[Process exited with code 0]");
+}
+
+void WebSocketServer::stopRun(Connection& connection) {
+    if (!connection.run) return;
+    {
+        lock_guard<mutex> lock(connection.outMutex);
+        connection.run->cancel = true;
+    }
+    connection.drained.notify_all();
+    connection.run->input.close();  // wakes a READ
+}
+
+void WebSocketServer::queue(Connection& connection, const string& bytes, const Run* waiter) {
+    unique_lock<mutex> lock(connection.outMutex);
+    if (waiter) {
+        connection.drained.wait(lock, [&connection, waiter] {
+            return connection.outbox.size() < kMaxOutbox || waiter->cancel;
+        });
+    }
+    connection.outbox += bytes;
+}
+
+void WebSocketServer::sendText(Connection& connection, const string& text) {
+    queue(connection, frame(Text, text));
+}
+
+// Writes what the socket takes; returns false once the connection is done
+bool WebSocketServer::flushOutbox(Connection& connection) {
+    bool empty;
+    {
+        lock_guard<mutex> lock(connection.outMutex);
+        size_t written = 0;
+        while (written < connection.outbox.size()) {
+            ssize_t n = ::send(connection.fd, connection.outbox.data() + written,
+                               connection.outbox.size() - written, MSG_NOSIGNAL);
+            if (n > 0) {
+                written += n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                return false;
+            }
+        }
+        connection.outbox.erase(0, written);
+        empty = connection.outbox.empty();
+    }
+    connection.drained.notify_all();
+
+    if (empty && connection.closing) return false;
+    if (empty == connection.watchingWrite) {
+        connection.watchingWrite = !empty;
+        epoll_event event = {};
+        event.events = EPOLLIN | (empty ? 0u : static_cast<uint32_t>(EPOLLOUT));
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+    return true;
+}
+
+void WebSocketServer::closeConnection(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+    stopRun(*it->second);
+    if (it->second->run) closedRuns.push_back(move(it->second->run));
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(it);
+}
+
+void WebSocketServer::reapRuns(bool wait) {
+    auto finished = [wait](const shared_ptr<Run>& run) {
+        if (!wait && !run->done) return false;
+        run->worker.join();
+        return true;
+    };
+    closedRuns.erase(remove_if(closedRuns.begin(), closedRuns.end(), finished), closedRuns.end());
+}
+
+void WebSocketServer::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd, &one, sizeof(one));
+    (void)written;
+}
+
+#endif